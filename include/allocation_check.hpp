@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Proves the steady-state hot paths do not allocate: a place/cancel cycle through
+// OrderManager and its exchange session, and a market-data broadcast tick to a live
+// loopback websocket client, both against an in-process loopback exchange while every
+// global operator new is counted (libcurl's too, through CurlMemory).
+// Counting needs a build configured with -DOEMS_ALLOCATION_COUNTING=ON; run it with
+// `deribit_order_management --alloc-check`.
+class AllocationCheck {
+public:
+    static bool countingEnabled();
+    // operator new calls so far, excluding threads inside an Uncounted scope
+    static uint64_t allocations();
+    // Returns the process exit code: 0 when both paths stayed allocation-free
+    static int run();
+
+    // Allocations on this thread are not counted while one is alive (the loopback exchange)
+    class Uncounted {
+    public:
+        Uncounted();
+        ~Uncounted();
+        Uncounted(const Uncounted&) = delete;
+        Uncounted& operator=(const Uncounted&) = delete;
+
+    private:
+        bool m_previous;
+    };
+};
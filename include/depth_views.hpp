@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Server-side aggregated depth. Each distinct (instrument, grouping, depth) view is
+// kept once however many clients watch it: the book's levels are summed into price
+// bins of the grouping (bids round down, asks round up, so bins never cross) and the
+// first `depth` bins are sent with their cumulative size. A new book is diffed level
+// by level against the previous one and only the changed levels touch the bins; a
+// view's frame is re-encoded only when its visible bins change, then shared by all
+// of its clients. Views are named "depth.<instrument>:<grouping>:<depth>", which is
+// also the symbol their clients hold in the SubscriptionRegistry. Thread-safe.
+class DepthViews {
+public:
+    static constexpr size_t kDefaultDepth = 10;
+    static constexpr size_t kMaxDepth = 100;
+    // Raw levels requested for an instrument with views, so wide bins have something to sum
+    static constexpr size_t kSourceLevels = 1000;
+
+    // Canonical view name; false if grouping is negative or depth is out of range.
+    // A grouping of 0 keeps exact prices (cumulative depth only).
+    static bool viewName(const std::string& instrument, double grouping, size_t depth, std::string& name);
+    static bool isView(const std::string& symbol) { return symbol.rfind("depth.", 0) == 0; }
+    // The instrument a well-formed view name aggregates; false for names viewName() would not produce.
+    static bool viewInstrument(const std::string& name, std::string& instrument);
+
+    // Keeps exactly the named views, creating missing ones from their instrument's
+    // last book, and returns the instruments whose books they need.
+    std::vector<std::string> retain(const std::vector<std::string>& names);
+    // Applies a public/get_order_book response for instrument to every view on it.
+    void applyBook(const std::string& instrument, const std::string& frame);
+    // Copies the view's frame into out if it changed since version, and advances version.
+    bool frameSince(const std::string& name, uint64_t& version, std::string& out);
+    // Latest frame of a view, for a new subscriber; empty until its first book.
+    std::string latest(const std::string& name);
+
+private:
+    struct Level {
+        double price;
+        double amount;
+
+        bool operator==(const Level& other) const { return price == other.price && amount == other.amount; }
+    };
+
+    // A bin counts its source levels, so it disappears exactly when its last level does
+    // rather than when a running sum of large amounts happens to round to zero
+    struct Bin {
+        double size = 0.0;
+        uint32_t levels = 0;
+    };
+
+    struct View {
+        std::string name;
+        std::string instrument;
+        double grouping = 0.0;
+        size_t depth = kDefaultDepth;
+        std::map<double, Bin> bids; // best bid is the last entry
+        std::map<double, Bin> asks; // best ask is the first entry
+        std::vector<Level> shownBids;
+        std::vector<Level> shownAsks;
+        std::string frame;
+        uint64_t version = 0;
+    };
+
+    struct Source {
+        std::vector<Level> bids; // last book as applied, best first
+        std::vector<Level> asks;
+        int64_t changeId = -1;
+        int64_t timestamp = 0;
+        bool loaded = false;
+        std::vector<View*> views;
+    };
+
+    std::map<std::string, View> m_views;
+    std::unordered_map<std::string, Source> m_sources;
+    std::vector<Level> m_nextBids;
+    std::vector<Level> m_nextAsks;
+    std::vector<Level> m_visible;
+    std::mutex m_mutex;
+
+    static bool parseName(const std::string& name, View& view);
+    static double bin(double price, double grouping, bool bid);
+    static void addToBin(View& view, bool bid, double price, double delta, int levels);
+    static void rebuild(View& view, const Source& source);
+    void refresh(View& view, const Source& source);
+    static void encode(View& view, const Source& source);
+};
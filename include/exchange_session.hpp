@@ -0,0 +1,119 @@
+#pragma once
+
+#include "rate_limit_scheduler.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One authenticated connection to the exchange shared by every caller.
+// Requests are JSON-RPC calls queued from any thread and pipelined by a single
+// worker, either over a reused, multiplexed HTTP connection or over one persistent
+// WebSocket; the access token is cached and refreshed before it expires, so callers
+// never authenticate themselves.
+// The WebSocket transport authenticates the connection itself, enables
+// cancel-on-disconnect for it (so the exchange pulls the orders it placed if the
+// connection drops), answers heartbeats and reconnects with backoff.
+// Outbound calls pass through a RateLimitScheduler, so bursts queue by priority
+// instead of failing with too_many_requests.
+// Request shells, payloads, URLs and response buffers are recycled, so a steady
+// stream of calls reuses memory instead of allocating per request.
+class ExchangeSession {
+public:
+    typedef RateLimitScheduler::ResponseCallback ResponseCallback;
+    // Sees every completed call (with its method and order id) before the caller's callbacks run
+    typedef std::function<void(const RateLimitScheduler::Request& request, bool ok, const std::string& response)> ResponseObserver;
+    // WebSocket transport only: told on the worker thread when the connection comes up or drops
+    typedef std::function<void(bool connected)> ConnectionObserver;
+
+    enum class Transport { Http, WebSocket };
+
+    ExchangeSession(const std::string& clientId, const std::string& clientSecret,
+                    const std::string& baseUrl = "https://test.deribit.com/api/v2", Transport transport = Transport::Http);
+    ~ExchangeSession();
+
+    // Set before start(); lets the owner do per-method bookkeeping without wrapping every callback.
+    void setResponseObserver(ResponseObserver observer) { m_observer = std::move(observer); }
+    void setConnectionObserver(ConnectionObserver observer) { m_connectionObserver = std::move(observer); }
+
+    void start();
+    void stop();
+
+    // Queues a call such as ("private/buy", "{\"instrument_name\":...}"); the callback runs on the worker thread.
+    // orderId lets the scheduler merge or drop stale queued edits and cancels of the same order.
+    // Before start() or after stop() the callback fails at once with "Exchange session stopped".
+    // stop() waits for replies to calls already sent; any still unanswered fail with "outcome unknown".
+    uint64_t submit(const std::string& method, const std::string& params, ResponseCallback callback, const std::string& orderId = "");
+    // Blocking convenience wrapper around submit(); throws on transport failure.
+    std::string call(const std::string& method, const std::string& params, const std::string& orderId = "");
+
+    // Always true over HTTP; over WebSocket, whether the connection is up and cancel-on-disconnect is armed
+    bool connected() const { return m_connected.load(); }
+    size_t inFlight() const { return m_inFlight.load(); }
+    uint64_t requestsSent() const { return m_requestsSent.load(); }
+    RateLimitScheduler::Stats schedulerStats();
+    // For accounts on a higher tier than the scheduler's defaults
+    void setRateLimits(RateLimitScheduler::Limits matching, RateLimitScheduler::Limits nonMatching);
+    // Fails every queued new order and edit; used by the kill switch.
+    void discardQueuedOrderFlow();
+
+    const std::string& clientId() const { return m_clientId; }
+    // Wall-clock expiry of the current token, for the snapshot; 0 before the first authentication.
+    int64_t tokenExpiresAtMs();
+
+private:
+    static constexpr size_t kMaxInFlight = 32;
+    // Idle sessions send a cheap request this often so the connection stays warm
+    static constexpr std::chrono::seconds kKeepAliveInterval{15};
+    static constexpr size_t kMaxSpareRequests = 2 * kMaxInFlight;
+    // The exchange sends a test_request this often; a connection silent for three intervals is dead
+    static constexpr int kHeartbeatSeconds = 10;
+    static constexpr std::chrono::seconds kHandshakeTimeout{10};
+    static constexpr std::chrono::seconds kMaxReconnectDelay{30};
+
+    std::string m_clientId;
+    std::string m_clientSecret;
+    std::string m_baseUrl;
+    Transport m_transport;
+
+    std::string m_accessToken;
+    std::chrono::steady_clock::time_point m_tokenExpiry;
+    std::mutex m_tokenMutex; // guards the token against tokenExpiresAtMs(); the worker is the only writer
+
+    RateLimitScheduler m_scheduler;
+    std::vector<RateLimitScheduler::Request> m_spareRequests; // cleared shells that keep their capacity
+    ResponseObserver m_observer;
+    ConnectionObserver m_connectionObserver;
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCv;
+    void* m_multi;
+
+    std::thread m_worker;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_connected;
+    std::atomic<uint64_t> m_nextId;
+    std::atomic<size_t> m_inFlight;
+    std::atomic<uint64_t> m_requestsSent;
+    std::chrono::steady_clock::time_point m_lastSent;
+    std::chrono::steady_clock::time_point m_authRetryAt;
+
+    void run();
+    void runSocket();
+    // Connects, authenticates and arms cancel-on-disconnect; nullptr on failure
+    void* openSocket();
+    void closeSocket(void* socket);
+    // Sends one call on a fresh socket and waits for its reply; used before any other traffic
+    bool handshake(void* socket, const std::string& method, const std::string& params, std::string& response);
+    void pullBatch(std::vector<RateLimitScheduler::Request>& batch, size_t active, bool keepAlive);
+    void finish(RateLimitScheduler::Request& request, bool ok, const std::string& response);
+    void recycle(RateLimitScheduler::Request& request);
+    void refreshToken();
+    void storeToken(const std::string& accessToken, int64_t expiresIn);
+    std::string authParams() const;
+    bool tokenNeedsRefresh() const;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <websocketpp/common/connection_hdl.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Log-linear histogram of microsecond latencies: exact below 16us, then eight
+// buckets per power of two (under 12.5% error), up to about 2^40us.
+class LatencyHistogram {
+public:
+    void record(int64_t micros);
+    uint64_t count() const { return m_count; }
+    int64_t max() const { return m_max; }
+    double mean() const { return m_count ? static_cast<double>(m_sum) / m_count : 0.0; }
+    // Upper bound of the bucket holding the q-th quantile (0 < q <= 1).
+    int64_t percentile(double q) const;
+
+private:
+    static constexpr int kSubBits = 3;
+    static constexpr int kLinear = 16;
+    static constexpr size_t kBuckets = kLinear + (40 - 4) * (1 << kSubBits);
+
+    std::array<uint32_t, kBuckets> m_buckets{};
+    uint64_t m_count = 0;
+    int64_t m_sum = 0;
+    int64_t m_max = 0;
+
+    static size_t bucketOf(int64_t micros);
+    static int64_t bucketUpperBound(size_t bucket);
+};
+
+// Latency measurements for each WebSocket connection:
+//  - RTT from protocol-level ping/pong probes (server clock only);
+//  - clock offset from NTP-style time_sync exchanges (t1..t4), keeping the
+//    sample with the smallest round-trip delay out of the last few;
+//  - fan-out lag between stamping a market-data frame and handing it to the
+//    connection, and the connection's unsent backlog;
+//  - one-way delivery latency from client receive reports, corrected by the offset.
+// Together these separate a slow network (RTT), a consumer that stops reading
+// (backlog) and a slow server loop (fan-out). Thread-safe.
+class LatencyMonitor {
+public:
+    struct Stats {
+        uint64_t connectionId = 0;
+        LatencyHistogram rtt;
+        LatencyHistogram delivery;
+        LatencyHistogram fanout;
+        bool synced = false;
+        int64_t offsetMicros = 0;     // client clock minus server clock
+        int64_t offsetDelayMicros = 0; // round-trip delay of the sample the offset came from
+        uint64_t syncSamples = 0;
+        uint64_t unsyncedReports = 0; // delivery reports received before any offset was known
+        uint64_t lostProbes = 0;
+        size_t backlogBytes = 0;
+        size_t maxBacklogBytes = 0;
+    };
+
+    // Wall-clock microseconds; this is the clock stamped into outgoing frames.
+    static int64_t nowMicros();
+
+    void addConnection(websocketpp::connection_hdl hdl);
+    void removeConnection(websocketpp::connection_hdl hdl);
+    // Every connection, and whether it takes part in time_sync (it asked for one once).
+    std::vector<std::pair<websocketpp::connection_hdl, bool>> probeTargets();
+
+    // Returns the payload for a WebSocket ping to hdl.
+    std::string beginPing(websocketpp::connection_hdl hdl);
+    bool onPong(websocketpp::connection_hdl hdl, const std::string& payload);
+
+    // Returns a {"type":"time_sync","id":..,"t1":..} frame for hdl; the client answers
+    // with {"action":"time_sync","id":..,"t1":..,"t2":<receive us>,"t3":<send us>}.
+    std::string beginTimeSync(websocketpp::connection_hdl hdl);
+    bool onTimeSync(websocketpp::connection_hdl hdl, uint64_t id, int64_t t1, int64_t t2, int64_t t3);
+
+    void onFanout(websocketpp::connection_hdl hdl, int64_t stampMicros, size_t backlogBytes);
+    // serverStampMicros is the frame's server_ts_us, clientReceiveMicros the client's clock on receipt.
+    void onDelivery(websocketpp::connection_hdl hdl, int64_t serverStampMicros, int64_t clientReceiveMicros);
+
+    bool stats(websocketpp::connection_hdl hdl, Stats& out);
+    std::vector<Stats> allStats();
+    // {"type":"latency_stats",...} for hdl; empty if nothing was measured yet.
+    std::string report(websocketpp::connection_hdl hdl);
+
+    // Inserts "server_ts_us" as the first member of a JSON object frame.
+    static std::string stampFrame(const std::string& frame, int64_t stampMicros);
+    // Same, written into out so a reused buffer keeps its capacity.
+    static void stampFrame(std::string& out, const std::string& frame, int64_t stampMicros);
+
+    // time_sync samples the offset is chosen from
+    static constexpr size_t kOffsetWindow = 8;
+
+private:
+    static constexpr size_t kMaxPendingProbes = 8;
+    static constexpr int64_t kProbeTimeoutMicros = 10 * 1000 * 1000;
+
+    struct OffsetSample {
+        int64_t offset;
+        int64_t delay;
+    };
+
+    struct Connection {
+        Stats stats;
+        std::map<uint64_t, std::chrono::steady_clock::time_point> pendingPings;
+        std::map<uint64_t, int64_t> pendingSyncs;
+        std::vector<OffsetSample> offsets;
+        size_t nextOffset = 0;
+        bool timeSync = false;
+    };
+
+    std::map<websocketpp::connection_hdl, Connection, std::owner_less<websocketpp::connection_hdl>> m_connections;
+    uint64_t m_nextConnectionId = 1;
+    uint64_t m_nextProbeId = 1;
+    std::mutex m_mutex;
+
+    Connection& connection(websocketpp::connection_hdl hdl);
+    void expireProbes(Connection& connection);
+    static std::string encode(const Stats& stats);
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// In-process stand-in for the exchange's REST API over HTTP/1.1 keep-alive, for
+// checks that must not touch the real exchange (point OEMS_EXCHANGE_URL at url()).
+// Each client_id is its own account: it holds its own orders and positions and,
+// when a credit limit is set, its own credit bucket, so a burst on one account is
+// rejected with too_many_requests (10028) while the others keep trading.
+// Cancels and edits of another account's order fail with order_not_found (10004).
+// Thread-safe.
+class LoopbackExchange {
+public:
+    // Runs the exchange's thread; lets the caller wrap it (the allocation check leaves it uncounted)
+    typedef std::function<void(const std::function<void()>& serve)> ThreadScope;
+
+    explicit LoopbackExchange(ThreadScope scope = nullptr);
+    ~LoopbackExchange();
+    LoopbackExchange(const LoopbackExchange&) = delete;
+    LoopbackExchange& operator=(const LoopbackExchange&) = delete;
+
+    std::string url() const;
+
+    // Every private call costs one credit; a full bucket holds maxCredits. Unlimited by default.
+    void setCreditLimit(double maxCredits, double refillPerSecond);
+    void setPosition(const std::string& clientId, const std::string& instrument, double size, double averagePrice);
+    // An order placed on the account behind the manager's back; returns its id
+    std::string addOrder(const std::string& clientId, const std::string& instrument, double amount, double price);
+
+    // Account holding an open order; empty when no account does
+    std::string ownerOf(const std::string& orderId);
+    size_t openOrders(const std::string& clientId);
+    // Private calls the account received for a method, including rejected ones
+    uint64_t calls(const std::string& clientId, const std::string& method);
+    uint64_t rateLimited(const std::string& clientId);
+
+private:
+    struct Connection;
+
+    struct Order {
+        std::string instrument;
+        std::string direction;
+        double amount = 0.0;
+        double price = 0.0;
+    };
+
+    struct Position {
+        double size = 0.0;
+        double averagePrice = 0.0;
+    };
+
+    struct Account {
+        std::map<std::string, Order> orders;
+        std::map<std::string, Position> positions;
+        std::map<std::string, uint64_t> calls;
+        uint64_t rateLimited = 0;
+        double credits = 0.0;
+        std::chrono::steady_clock::time_point updated;
+        bool initialized = false;
+    };
+
+    boost::asio::io_context m_io;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::map<std::string, Account> m_accounts;
+    double m_maxCredits = 0.0;
+    double m_refillPerSecond = 0.0;
+    uint64_t m_nextOrderId = 1;
+    int64_t m_changeId = 1;
+
+    void accept();
+    std::string reply(const std::string& target, const std::string& authorization, const std::string& body);
+    Account& account(const std::string& clientId);
+    bool takeCredit(Account& account);
+    static std::string orderJson(const std::string& orderId, const Order& order, const char* state);
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <rapidjson/document.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// rapidjson base allocator over the global operator new, so the parse trees'
+// overflow chunks show up in the allocation-counting build like everything else.
+class HeapAllocator {
+public:
+    static const bool kNeedFree = true;
+
+    void* Malloc(size_t size);
+    void* Realloc(void* original, size_t originalSize, size_t newSize);
+    static void Free(void* ptr);
+
+    bool operator==(const HeapAllocator&) const { return true; }
+    bool operator!=(const HeapAllocator&) const { return false; }
+};
+
+// Per-thread parse arena for exchange responses. The document and its parse stack
+// live in one buffer allocated on the thread's first parse; each parse() rewinds
+// the arena instead of freeing, so parsing a typical response does not touch the heap.
+// The returned document is valid until the next parse() on the same thread, so
+// only leaf code that is done with it before calling out should use the arena.
+class JsonArena {
+public:
+    typedef rapidjson::MemoryPoolAllocator<HeapAllocator> Allocator;
+    typedef rapidjson::GenericDocument<rapidjson::UTF8<>, Allocator, Allocator> Document;
+
+    static JsonArena& local();
+
+    Document& parse(const std::string& json);
+
+    JsonArena(const JsonArena&) = delete;
+    JsonArena& operator=(const JsonArena&) = delete;
+
+private:
+    static constexpr size_t kValueBytes = 48 * 1024;
+    static constexpr size_t kStackBytes = 16 * 1024;
+
+    JsonArena();
+
+    std::unique_ptr<char[]> m_buffer;
+    HeapAllocator m_base;
+    Allocator m_values;
+    Allocator m_stack;
+    Document m_document;
+};
+
+// libcurl's allocator. Installed with curl_global_init_mem before any other curl call,
+// it keeps freed blocks in power-of-two size classes and hands them out again, so a
+// steady stream of transfers on reused handles stops hitting the heap. Fresh blocks
+// come from the global operator new, so the allocation-counting build sees them too.
+// Thread-safe.
+class CurlMemory {
+public:
+    // Call first thing in main(): once curl is initialized its allocator is fixed
+    static bool install();
+};
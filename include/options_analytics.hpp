@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Implied volatility and Greeks for whole option chains.
+// A chain is loaded from public/get_instruments and kept as one
+// structure-of-arrays slice per expiry; it is reloaded when it ages, when an
+// expiry passes or when quotes name options it does not list. Quote updates
+// only mark their expiry dirty; snapshot() re-solves the dirty expiries on a
+// persistent pool of solver threads and re-encodes the chain's frame, which
+// subscribers to "greeks.<CURRENCY>" receive.
+// Thread-safe.
+class OptionsAnalytics {
+public:
+    static constexpr int64_t kReloadIntervalMs = 10 * 60 * 1000;
+    static constexpr int64_t kReloadRetryMs = 5 * 1000;
+
+    OptionsAnalytics() = default;
+    ~OptionsAnalytics();
+
+    // Replaces the chain for currency with the unexpired options in a get_instruments response.
+    size_t loadChain(const std::string& currency, const std::string& instrumentsJson);
+    bool hasChain(const std::string& currency);
+    // Whether the chain is missing or out of date; true at most once per kReloadRetryMs,
+    // so a failing reload is not retried on every tick.
+    bool reloadDue(const std::string& currency);
+
+    // Quotes are in the exchange's option price units (fractions of the underlying).
+    bool updateQuote(const std::string& instrumentName, double bid, double ask, double underlyingPrice);
+    // Applies a public/get_book_summary_by_currency response for kind=option.
+    size_t applyBookSummary(const std::string& currency, const std::string& summaryJson);
+    // Applies a public/get_order_book response if it is for an option of a loaded chain;
+    // books of other instruments are ignored.
+    bool applyOrderBook(const std::string& orderBookJson);
+
+    // Recomputes what changed and returns the encoded chain; empty if no chain is loaded.
+    std::string snapshot(const std::string& currency);
+    int64_t lastComputeMicros(const std::string& currency);
+
+private:
+    struct Expiry {
+        int64_t expirationMs = 0;
+        double forward = 0.0;
+        bool dirty = true;
+        std::vector<std::string> names;
+        std::vector<double> strike, sign, mid, premium, iv, delta, gamma, vega, theta;
+    };
+
+    struct Chain {
+        std::vector<Expiry> expiries;
+        std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> index;
+        std::string frame;
+        bool frameStale = true;
+        int64_t computeMicros = 0;
+        int64_t loadedMs = 0;
+        int64_t firstExpiryMs = 0;
+        bool unlisted = false; // a quote named an option the chain does not have
+    };
+
+    std::unordered_map<std::string, Chain> m_chains;
+    std::unordered_map<std::string, int64_t> m_reloadAttemptMs;
+    std::mutex m_mutex;
+
+    // Solver pool, started on the first recompute with more than one dirty expiry.
+    // recompute() publishes the dirty expiries and claims them alongside the workers.
+    std::vector<std::thread> m_workers;
+    std::mutex m_workMutex;
+    std::condition_variable m_workReady;
+    std::condition_variable m_workDone;
+    std::vector<Expiry*> m_work;
+    int64_t m_workNowMs = 0;
+    std::atomic<size_t> m_nextWork{0};
+    size_t m_busyWorkers = 0;
+    uint64_t m_workGeneration = 0;
+    bool m_stopping = false;
+
+    bool updateQuoteLocked(const std::string& instrumentName, double bid, double ask, double underlyingPrice);
+    void recompute(Chain& chain);
+    void workerLoop();
+    void solvePending();
+    static void solveExpiry(Expiry& expiry, int64_t nowMs);
+    static void encode(const std::string& currency, Chain& chain);
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+// Batch Black-76 kernels over structure-of-arrays inputs.
+// Every batch shares one forward and one time to expiry (one expiry of a chain);
+// lane updates are blends on 0/1 masks rather than branches, so the compiler
+// vectorizes them across strikes (checked with -fopt-info-vec). Output arrays
+// must not overlap the inputs or each other.
+// sign is +1 for calls and -1 for puts; rates are taken as zero, as for
+// options on Deribit futures.
+namespace OptionsPricing {
+
+    double black76Price(double forward, double strike, double vol, double t, double sign);
+
+    // Safeguarded Newton: each lane keeps a bracket and falls back to bisection when a
+    // Newton step leaves it, and stops moving once its price is within tolerance.
+    // Lanes whose price is not finite or violates no-arbitrage bounds get NaN.
+    void impliedVolBatch(double forward, double t, const double* strike, const double* sign,
+                         const double* price, double* vol, size_t n);
+
+    // Vega is per vol point (0.01) and theta per calendar day.
+    void greeksBatch(double forward, double t, const double* strike, const double* sign, const double* vol,
+                     double* delta, double* gamma, double* vega, double* theta, size_t n);
+}
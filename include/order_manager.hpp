@@ -1,15 +1,187 @@
 #pragma once
 
+#include "exchange_session.hpp"
+#include "state_snapshot.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class OrderManager {
 public:
-    std::string placeOrder(const std::string& symbol,const std::string& type, double amount, double price, const std::string& orderType);
+    typedef ExchangeSession::ResponseCallback ResponseCallback;
+
+    // Every requested edit is eventually sent, coalesced into a later edit, or dropped
+    struct AmendStats {
+        uint64_t requested = 0;
+        uint64_t sent = 0;
+        uint64_t coalesced = 0;
+        uint64_t dropped = 0;
+    };
+
+    struct KillSwitchReport {
+        bool ok = false;
+        bool flat = false;
+        uint64_t cancelled = 0;
+        int64_t ackMicros = 0;   // trigger -> cancel_all acknowledged
+        int64_t flatMicros = 0;  // trigger -> no open orders confirmed
+        std::string error;
+    };
+    typedef std::function<void(const KillSwitchReport&)> KillSwitchCallback;
+
+    // How new orders are spread over the account sessions
+    enum class RoutingPolicy { ByInstrument, ByStrategyTag, LeastLoaded };
+
+    struct Account {
+        std::string clientId;
+        std::string clientSecret;
+    };
+
+    // What reconcile() found changed on the exchange since the snapshot was written
+    struct ReconcileReport {
+        bool ok = false;
+        size_t ordersKept = 0;
+        size_t ordersChanged = 0;
+        size_t ordersAdded = 0;
+        size_t ordersRemoved = 0;
+        size_t positionsChanged = 0;
+        int64_t micros = 0;
+        std::string error;
+    };
+
+    // The config.hpp account plus any "id:secret,id:secret" listed in OEMS_ACCOUNTS,
+    // against OEMS_EXCHANGE_URL when set (e.g. a local stand-in exchange).
+    // Orders go over one WebSocket per account with cancel-on-disconnect, unless
+    // OEMS_ORDER_TRANSPORT=http selects stateless HTTP (which has no such protection).
+    // A restored snapshot seeds tracked orders and positions before the sessions start.
+    explicit OrderManager(const StateSnapshot::State* restored = nullptr);
+    OrderManager(const std::vector<Account>& accounts, const std::string& baseUrl, const StateSnapshot::State* restored = nullptr,
+                 ExchangeSession::Transport transport = ExchangeSession::Transport::WebSocket);
+    ~OrderManager();
+
+    std::string placeOrder(const std::string& symbol,const std::string& type, double amount, double price, const std::string& orderType, const std::string& strategyTag = "");
     std::string cancelOrder(const std::string& order_id);
     std::string modifyOrder(const std::string& order_id, double new_amount, double new_price);
     std::string getOrderBook(const std::string& symbol);
+    // Positions and open orders are aggregated across every account session
     std::string getCurrentPositions(const std::string& currency);
+    std::string getOpenOrders();
     std::string getInstruments();
     std::string getInstrumentOrderbook(const std::string& instrumentName);
-};
\ No newline at end of file
+
+    // Mass cancels (private/cancel_all*); they jump every queue in the rate-limit scheduler.
+    std::string cancelAll();
+    std::string cancelAllByInstrument(const std::string& instrumentName);
+    std::string cancelAllByCurrency(const std::string& currency);
+    void cancelAllAsync(const std::string& currency, const std::string& instrumentName, ResponseCallback callback);
+
+    // Drops queued order flow, cancels everything and polls until the account is flat.
+    // New orders and edits are then rejected until rearm().
+    void triggerKillSwitch(KillSwitchCallback done);
+    KillSwitchReport killSwitch();
+    KillSwitchReport lastKillSwitch();
+    void rearm();
+    bool killSwitchEngaged() const { return m_killSwitchEngaged.load(); }
+
+    // Non-blocking variants used by the WebSocket order gateway; callbacks run on the session worker.
+    void placeOrderAsync(const std::string& symbol, const std::string& type, double amount, double price, const std::string& orderType, ResponseCallback callback, const std::string& strategyTag = "");
+    void cancelOrderAsync(const std::string& order_id, ResponseCallback callback);
+    void modifyOrderAsync(const std::string& order_id, double new_amount, double new_price, ResponseCallback callback);
+
+    void setRoutingPolicy(RoutingPolicy policy);
+    // Pins a strategy tag to one session under RoutingPolicy::ByStrategyTag
+    void assignStrategy(const std::string& strategyTag, size_t sessionIndex);
+
+    // Warm restart: export tracked state for the snapshot writer, and after a restore,
+    // bring tracked orders and positions in line with the exchange.
+    void exportState(StateSnapshot::State& state);
+    ReconcileReport reconcile();
+
+    // Whether the order is still open as far as this process knows
+    bool tracksOrder(const std::string& order_id);
+
+    size_t sessionCount() const { return m_sessions.size(); }
+    ExchangeSession& session(size_t index = 0) { return *m_sessions[index]; }
+    AmendStats amendStats();
+
+private:
+    // At most one edit per order is outstanding; newer edits replace the pending one
+    struct AmendState {
+        bool hasPending = false;
+        double amount = 0.0;
+        double price = 0.0;
+        std::vector<ResponseCallback> callbacks;
+        size_t coalesced = 0; // parked callbacks already counted as coalesced
+    };
+
+    // Orders this process placed (or found on reconcile), and the session that owns each
+    struct TrackedOrder {
+        size_t session = 0;
+        std::string instrument;
+        std::string direction;
+        double price = 0.0;
+        double amount = 0.0;
+    };
+
+    typedef std::vector<std::pair<bool, std::string>> GatheredResponses;
+    typedef std::unordered_map<std::string, TrackedOrder> OrderMap;
+    struct KillSwitchRun;
+
+    // Forgotten orders' map nodes are kept for the next order, up to this many
+    static constexpr size_t kMaxSpareOrders = 256;
+    static constexpr size_t kAllSessions = static_cast<size_t>(-1);
+
+    std::vector<std::unique_ptr<ExchangeSession>> m_sessions;
+    // Shared by the sessions and the public market-data calls
+    std::string m_baseUrl;
+    RoutingPolicy m_routingPolicy;
+    std::unordered_map<std::string, size_t> m_strategySessions;
+    OrderMap m_orders;
+    std::vector<OrderMap::node_type> m_spareOrders;
+    std::mutex m_routingMutex;
+    std::unordered_map<std::string, StateSnapshot::Position> m_positions;
+    std::mutex m_positionMutex;
+    std::unordered_map<std::string, AmendState> m_amends;
+    std::mutex m_amendMutex;
+    AmendStats m_amendStats;
+    KillSwitchReport m_lastKillSwitch;
+    std::mutex m_killSwitchMutex;
+    std::atomic<bool> m_killSwitchEngaged{false};
+
+    static constexpr int kFlatCheckAttempts = 3;
+
+    void sendAmend(const std::string& order_id, double amount, double price, std::vector<ResponseCallback> callbacks);
+    void onAmendComplete(const std::string& order_id);
+    void dropPendingAmend(const std::string& order_id);
+    void dropAllPendingAmends();
+    void confirmFlat(size_t sessionIndex, std::shared_ptr<KillSwitchRun> run, int attempts);
+    void finishKillSwitchSession(std::shared_ptr<KillSwitchRun> run, bool accepted, bool flat, const std::string& error);
+
+    size_t routeOrder(const std::string& instrumentName, const std::string& strategyTag);
+    // The session that owns an order, or kAllSessions when it is not tracked
+    size_t sessionIndexForOrder(const std::string& order_id);
+    void submitForOrder(const std::string& method, const std::string& params, const std::string& order_id, ResponseCallback callback);
+    // Session observer: order tracking follows place, edit and cancel responses
+    void onSessionResponse(size_t sessionIndex, const RateLimitScheduler::Request& request, bool ok, const std::string& response);
+    void rememberOrder(size_t sessionIndex, const std::string& response);
+    void rememberPositions(const std::string& currency, const std::string& response);
+    void forgetOrder(const std::string& order_id);
+    // Forgets a session's orders that a mass cancel with these params removed
+    void forgetCancelled(size_t sessionIndex, const std::string& method, const std::string& params);
+    // After a reconnect: forget the session's orders the exchange no longer has open
+    void resyncOrders(size_t sessionIndex);
+    // Sends one call to every session; done receives the responses in session order
+    void gatherAsync(const std::string& method, const std::string& params, std::function<void(GatheredResponses)> done, const std::string& orderId = "");
+    GatheredResponses gather(const std::string& method, const std::string& params);
+    static std::string sumResults(const GatheredResponses& responses);
+
+    static void orderParams(std::string& out, const std::string& symbol, double amount, double price, const std::string& orderType);
+    static void editParams(std::string& out, const std::string& order_id, double amount, double price);
+    static void stringParams(std::string& out, const char* key, const std::string& value);
+    // Empty when the order may be sent; otherwise why not
+    static std::string validateOrder(const std::string& side, double quantity, double price, const std::string& orderType);
+};
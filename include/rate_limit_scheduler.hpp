@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// Local model of the exchange's credit-based rate limit.
+// Requests wait in per-priority queues (cancel > modify > new > market data)
+// and are only released when the matching or non-matching credit bucket can
+// pay for them, so nothing is sent that the exchange would reject with
+// too_many_requests. Stale queued work is merged or dropped on enqueue.
+// Queue blocks come from a private pool, so steady traffic does not hit the heap.
+// Not thread-safe: the caller serializes access.
+class RateLimitScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void(bool ok, const std::string& response)> ResponseCallback;
+
+    enum Priority { Cancel = 0, Modify = 1, New = 2, MarketData = 3, PriorityCount = 4 };
+
+    struct Limits {
+        double maxCredits;
+        double refillPerSecond;
+        double cost;
+    };
+
+    struct Request {
+        uint64_t id = 0;
+        std::string method;
+        std::string params;
+        std::string orderId;
+        std::vector<ResponseCallback> callbacks;
+        Clock::time_point enqueued;
+    };
+
+    struct Stats {
+        std::array<size_t, PriorityCount> queued{};
+        uint64_t sent = 0;
+        uint64_t merged = 0;
+        uint64_t dropped = 0;
+        uint64_t rateLimited = 0;
+        double matchingUtilization = 0.0;
+        double nonMatchingUtilization = 0.0;
+    };
+
+    // Defaults follow the exchange's default account tier
+    explicit RateLimitScheduler(Limits matching = {20000, 5000, 1000}, Limits nonMatching = {50000, 10000, 500});
+    // Another account tier; both buckets start full.
+    void setLimits(Limits matching, Limits nonMatching);
+
+    // Queues a request; a modify replaces a queued modify of the same order, a cancel
+    // drops queued modifies of its order, and identical market-data requests share one slot.
+    // Callbacks of dropped requests are returned so the caller can fail them outside its lock.
+    std::vector<ResponseCallback> enqueue(Request request, Clock::time_point now);
+    // Puts a request the exchange throttled back at the head of its queue.
+    void retry(Request request);
+    // Pops the highest-priority request whose bucket can pay for it right now.
+    bool next(Request& out, Clock::time_point now);
+    // Time until next() could release something; zero when it already can.
+    Clock::duration waitTime(Clock::time_point now);
+    // The exchange rejected a request anyway: assume the bucket is empty.
+    void onRateLimited(const std::string& method, Clock::time_point now);
+
+    // Kill switch: drops queued new orders and edits, returning their callbacks.
+    std::vector<ResponseCallback> discardOrderFlow();
+    std::vector<Request> drain();
+    bool empty() const;
+    Stats stats(Clock::time_point now);
+
+    static Priority classify(const std::string& method);
+    static bool isMatchingEngine(const std::string& method);
+
+private:
+    struct Bucket {
+        Limits limits;
+        double credits;
+        Clock::time_point updated;
+
+        void refill(Clock::time_point now);
+    };
+
+    std::pmr::unsynchronized_pool_resource m_pool;
+    std::array<std::pmr::deque<Request>, PriorityCount> m_queues;
+    Bucket m_matching;
+    Bucket m_nonMatching;
+    Stats m_stats;
+
+    Bucket& bucketFor(const std::string& method);
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Warm-restart state: instrument registry, latest books with their change ids,
+// open orders (with the account session that owns them), positions and each
+// account's token expiry (never the token itself). The file is a fixed header
+// followed by flat length-prefixed records; load() maps it read-only and decodes
+// straight from the mapping, and write() replaces it atomically and durably, so a
+// crash mid-write leaves the previous snapshot intact. It lists the accounts' orders
+// and positions, so it is created owner-read/write only.
+class StateSnapshot {
+public:
+    struct Instrument {
+        std::string name;
+        std::string kind;
+    };
+
+    struct Level {
+        double price;
+        double amount;
+    };
+
+    struct Book {
+        std::string instrument;
+        int64_t changeId = 0;
+        int64_t timestampMs = 0;
+        std::vector<Level> bids;
+        std::vector<Level> asks;
+    };
+
+    struct Order {
+        std::string orderId;
+        std::string instrument;
+        std::string direction;
+        double price = 0.0;
+        double amount = 0.0;
+        uint32_t session = 0;
+    };
+
+    struct Position {
+        std::string instrument;
+        double size = 0.0;
+        double averagePrice = 0.0;
+    };
+
+    struct TokenExpiry {
+        std::string clientId;
+        int64_t expiresAtMs = 0; // wall clock
+    };
+
+    struct State {
+        int64_t writtenAtMs = 0;
+        std::vector<Instrument> instruments;
+        std::vector<Book> books;
+        std::vector<Order> orders;
+        std::vector<Position> positions;
+        std::vector<TokenExpiry> tokenExpiries;
+    };
+
+    typedef std::function<void(State&)> Collector;
+
+    static bool write(const std::string& path, const State& state);
+    // False if the file is missing, truncated, corrupt or from another format version.
+    static bool load(const std::string& path, State& state);
+
+    StateSnapshot(const std::string& path, std::chrono::milliseconds interval);
+    ~StateSnapshot();
+
+    // Writes a snapshot every interval from what collector gathers; stop() writes a final one.
+    void start(Collector collector);
+    void stop();
+
+    uint64_t writes() const { return m_writes.load(); }
+    int64_t lastWriteMicros() const { return m_lastWriteMicros.load(); }
+    size_t lastSizeBytes() const { return m_lastSizeBytes.load(); }
+
+private:
+    // 2: token expiries replace the stored access tokens
+    static constexpr uint32_t kVersion = 2;
+
+    std::string m_path;
+    std::chrono::milliseconds m_interval;
+    Collector m_collector;
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+    std::atomic<uint64_t> m_writes;
+    std::atomic<int64_t> m_lastWriteMicros;
+    std::atomic<size_t> m_lastSizeBytes;
+
+    void writeNow();
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <websocketpp/common/connection_hdl.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Tracks which connections want updates for which symbols.
+// Symbols are interned to dense integer ids so the broadcast path walks flat
+// subscriber vectors, and each connection keeps a reverse index of its own
+// subscriptions so a disconnect only touches the symbols that client used.
+// Not thread-safe: the caller serializes access.
+class SubscriptionRegistry {
+public:
+    typedef uint32_t SymbolId;
+    static constexpr SymbolId kInvalidSymbol = UINT32_MAX;
+
+    // Registers a symbol (and optionally its instrument kind) and returns its id.
+    SymbolId intern(const std::string& symbol, const std::string& kind = "");
+    SymbolId find(const std::string& symbol) const;
+    const std::string& symbolName(SymbolId id) const;
+    const std::string& symbolKind(SymbolId id) const;
+    size_t symbolCount() const { return m_symbols.size(); }
+
+    bool subscribe(websocketpp::connection_hdl hdl, const std::string& symbol);
+    bool unsubscribe(websocketpp::connection_hdl hdl, const std::string& symbol);
+
+    // Glob subscriptions ('*' and '?'), optionally restricted to a kind such as "option".
+    // Only symbols interned with a kind (listed instruments) match, never synthetic ones.
+    // A pattern is resolved once into a set of ids; symbols interned later are matched as they arrive.
+    size_t subscribePattern(websocketpp::connection_hdl hdl, const std::string& pattern, const std::string& kind = "");
+    bool unsubscribePattern(websocketpp::connection_hdl hdl, const std::string& pattern, const std::string& kind = "");
+
+    void removeConnection(websocketpp::connection_hdl hdl);
+
+    const std::vector<websocketpp::connection_hdl>& subscribers(SymbolId id) const;
+    std::vector<SymbolId> activeSymbols() const;
+    size_t connectionCount() const { return m_connections.size(); }
+
+    // Bumped whenever any subscriber list changes, so readers can cache snapshots.
+    uint64_t generation() const { return m_generation; }
+
+    static bool matchesPattern(const std::string& pattern, const std::string& symbol);
+
+private:
+    struct Connection;
+
+    struct Membership {
+        uint32_t slot;
+        uint32_t refs;
+        bool direct;
+    };
+
+    struct PatternEntry {
+        std::string glob;
+        std::string kind;
+        std::vector<SymbolId> matches;
+        std::unordered_set<Connection*> owners;
+    };
+
+    struct Connection {
+        websocketpp::connection_hdl hdl;
+        std::unordered_map<SymbolId, Membership> symbols;
+        std::vector<PatternEntry*> patterns;
+    };
+
+    std::unordered_map<std::string, SymbolId> m_symbolIds;
+    std::vector<std::string> m_symbols;
+    std::vector<std::string> m_kinds;
+    std::vector<std::vector<websocketpp::connection_hdl>> m_subscribers;
+    std::vector<std::vector<Connection*>> m_owners;
+    std::map<websocketpp::connection_hdl, Connection, std::owner_less<websocketpp::connection_hdl>> m_connections;
+    std::map<std::pair<std::string, std::string>, PatternEntry> m_patterns;
+    uint64_t m_generation = 0;
+
+    Connection& connectionFor(websocketpp::connection_hdl hdl);
+    bool patternMatches(const PatternEntry& entry, SymbolId id) const;
+    void addRef(Connection& conn, SymbolId id);
+    void release(Connection& conn, SymbolId id);
+    void detach(SymbolId id, uint32_t slot);
+    void dropIfIdle(Connection& conn);
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace UtilityNamespace {
@@ -8,5 +9,14 @@ namespace UtilityNamespace {
     std::string sendPostRequestWithAuth(const std::string& url, const std::string& payload, const std::string& authHeader);
     std::string sendPostRequest(const std::string& url, const std::string& payload);
     std::string sendGetRequest(const std::string& url);
+    // GET into out, reusing its capacity and this thread's connection; false on transport failure
+    bool fetchInto(const std::string& url, std::string& out);
+    // Base REST URL of the exchange: OEMS_EXCHANGE_URL when set, else the Deribit test network
+    std::string exchangeBaseUrl();
+    // Percent-encodes a value for a URL query string
+    std::string urlEncode(const std::string& value);
+    // Number formatting for hand-built JSON that never goes through a temporary string
+    void appendNumber(std::string& out, int64_t value);
+    void appendNumber(std::string& out, double value);
     void logMessage(const std::string& message);
 }
\ No newline at end of file
@@ -2,9 +2,21 @@
 
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
-#include <unordered_map>
+#include <rapidjson/document.h>
+#include "depth_views.hpp"
+#include "latency_monitor.hpp"
+#include "options_analytics.hpp"
+#include "order_manager.hpp"
+#include "state_snapshot.hpp"
+#include "subscription_registry.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <mutex>
 #include <thread>
 #include <atomic>
@@ -14,22 +26,135 @@ typedef websocketpp::connection_hdl connection_hdl;
 
 class WebSocketHandler {
 public:
+    struct WarmStartReport {
+        size_t booksUnchanged = 0; // same change_id as in the snapshot
+        size_t booksUpdated = 0;
+        size_t booksFailed = 0;
+        size_t instruments = 0;
+        int64_t firstValidQuoteMicros = -1;
+    };
+
+    // Market data comes from OEMS_EXCHANGE_URL when set, like the order sessions
     WebSocketHandler();
+    explicit WebSocketHandler(const std::string& baseUrl);
     ~WebSocketHandler();
 
     void startServer(uint16_t port);
     void stopServer();
     void broadcastOrderBookUpdates(std::atomic<bool>& isBroadcasting);
 
+    // Accept place/modify/cancel from clients that authenticate with accessToken,
+    // multiplexed onto the OrderManager's shared exchange session.
+    void enableOrderGateway(OrderManager& orderManager, const std::string& accessToken);
+    void disableOrderGateway();
+
+    // Warm restart. bootTime anchors time-to-first-valid-quote; restored is null on a cold start.
+    void restoreState(const StateSnapshot::State* restored, std::chrono::steady_clock::time_point bootTime);
+    void exportState(StateSnapshot::State& state);
+    // Restored books are served marked stale until this re-fetches them (then refreshes the
+    // instrument list) and counts what moved.
+    WarmStartReport reconcileState();
+    int64_t firstValidQuoteMicros() const { return m_firstValidQuoteMicros.load(); }
+
+    // Per-connection RTT, clock offset, fan-out and delivery latency.
+    std::vector<LatencyMonitor::Stats> latencyStats() { return m_latency.allStats(); }
+
 private:
+    struct GatewayClient {
+        bool authenticated = false;
+        std::set<std::string> orders;
+        size_t inFlight = 0;
+        uint64_t placed = 0;
+        uint64_t modified = 0;
+        uint64_t cancelled = 0;
+        uint64_t rejected = 0;
+    };
+
+    // Outlives the handler so late exchange callbacks can tell it is gone
+    struct GatewayGuard {
+        std::mutex mutex;
+        bool alive = true;
+    };
+
+    // One broadcast symbol: its subscribers as of the last registry change, and its book buffer.
+    // A depth source has no clients: it fetches a deep book that only feeds the depth views.
+    struct BroadcastTarget {
+        std::string symbol;
+        std::vector<connection_hdl> clients;
+        std::string book;
+        bool depthSource = false;
+        uint64_t viewVersion = 0; // depth views: the frame version these clients last got
+        bool option = false;      // raw option books also feed the analytics chain
+    };
+
+    friend class AllocationCheck;
+
+    static constexpr size_t kMaxClientInFlight = 16;
+    static constexpr long kProbeIntervalMs = 1000;
+    // The instrument list changes a few times a day; a failed load is retried sooner
+    static constexpr long kCatalogRefreshSeconds = 600;
+    static constexpr long kCatalogRetrySeconds = 5;
+    // Threads fetching restored books on a warm start
+    static constexpr size_t kReconcileFetchers = 8;
+    // Outbound frames kept for reuse; a frame still queued on a slow connection is skipped
+    static constexpr size_t kMaxPooledFrames = 8;
+
+    std::string m_baseUrl;
     server m_server;
-    std::unordered_map<std::string, std::set<connection_hdl, std::owner_less<connection_hdl>>> m_subscriptions;
+    SubscriptionRegistry m_subscriptions;
+    // Currencies with listed options, the only ones "greeks.<CURRENCY>" accepts
+    std::set<std::string> m_optionCurrencies;
     std::mutex m_subscriptionMutex;
+    std::atomic<bool> m_instrumentsLoaded;
+    OptionsAnalytics m_analytics;
+    LatencyMonitor m_latency;
+    DepthViews m_depthViews;
+    // Latest book frame per symbol, sent to new subscribers right away; restored ones carry "stale":true
+    std::unordered_map<std::string, std::string> m_latestBooks;
+    std::mutex m_bookMutex;
+    std::vector<StateSnapshot::Book> m_restoredBooks;
+    std::chrono::steady_clock::time_point m_bootTime;
+    std::atomic<int64_t> m_firstValidQuoteMicros;
+    // Broadcast thread only
+    std::vector<BroadcastTarget> m_broadcastTargets;
+    uint64_t m_broadcastGeneration = UINT64_MAX;
+    std::vector<server::message_ptr> m_framePool;
+    server::timer_ptr m_probeTimer;
     std::thread m_serverThread;
+    std::thread m_catalogThread;
+    std::mutex m_catalogMutex;
+    std::condition_variable m_catalogWake;
     std::atomic<bool> m_running;
 
+    OrderManager* m_orderGateway;
+    std::string m_gatewayToken;
+    std::map<connection_hdl, GatewayClient, std::owner_less<connection_hdl>> m_gatewayClients;
+    std::mutex m_gatewayMutex;
+    std::shared_ptr<GatewayGuard> m_gatewayGuard;
+
     void run(uint16_t port);
     void handleMessage(connection_hdl hdl, server::message_ptr msg);
     void handleClose(connection_hdl hdl);
-    std::string getOrderBook(const std::string& symbol);
+    void handleLatencyMessage(connection_hdl hdl, const std::string& action, const rapidjson::Document& doc);
+    void scheduleProbes();
+    void sendProbes();
+    void handleGatewayMessage(connection_hdl hdl, const std::string& action, const rapidjson::Document& doc);
+    void handleGatewayResponse(connection_hdl hdl, const std::string& action, const std::string& reqId, bool ok, const std::string& response);
+    void pruneGatewayOrders(connection_hdl hdl);
+    void handleKillSwitchReport(connection_hdl hdl, const std::string& reqId, const OrderManager::KillSwitchReport& report);
+    void sendGatewayError(connection_hdl hdl, const std::string& reqId, const std::string& error);
+    void refreshInstruments();
+    bool loadInstruments();
+    // Both called with m_subscriptionMutex held
+    void internInstrument(const std::string& name, const std::string& kind);
+    bool subscribable(const std::string& symbol) const;
+    void noteValidQuote(const std::string& symbol, const std::string& frame);
+    void broadcastTick();
+    void rebuildBroadcastTargets();
+    // A pooled frame no connection still holds, with payload left for the caller to fill
+    server::message_ptr pooledFrame();
+    // Frames the payload once for every connection: servers do not mask, so the bytes are the same for all
+    static void prepareFrame(const server::message_ptr& frame);
+    void getOrderBook(const std::string& symbol, std::string& out, size_t depth = 0);
+    std::string getGreeks(const std::string& currency);
 };
\ No newline at end of file
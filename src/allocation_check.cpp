@@ -0,0 +1,252 @@
+#include "allocation_check.hpp"
+#include "loopback_exchange.hpp"
+#include "order_manager.hpp"
+#include "websocket_handler.hpp"
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace {
+    std::atomic<uint64_t> g_allocations{0};
+    thread_local bool t_uncounted = false;
+}
+
+#ifdef OEMS_ALLOCATION_COUNTING
+
+namespace {
+    void* countedAllocate(std::size_t size) {
+        if (!t_uncounted) {
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        return std::malloc(size ? size : 1);
+    }
+}
+
+void* operator new(std::size_t size) {
+    if (void* ptr = countedAllocate(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    if (void* ptr = countedAllocate(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+
+#endif
+
+namespace {
+    constexpr int kWarmup = 200;
+    constexpr int kIterations = 2000;
+
+    struct Pending {
+        std::atomic<int> state{0};
+        std::string orderId;
+    };
+
+    bool await(const Pending& pending) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (pending.state.load() == 0) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return pending.state.load() > 0;
+    }
+
+    bool placeAndCancel(OrderManager& orderManager, Pending& pending) {
+        pending.state = 0;
+        orderManager.placeOrderAsync("BTC-PERPETUAL", "buy", 10.0, 50000.0, "limit", [&pending](bool ok, const std::string& response) {
+            size_t start = response.find("\"order_id\":\"");
+            if (ok && start != std::string::npos) {
+                start += 12;
+                pending.orderId.assign(response, start, response.find('"', start) - start);
+            }
+            pending.state = (ok && start != std::string::npos) ? 1 : -1;
+        });
+        if (!await(pending)) {
+            return false;
+        }
+
+        pending.state = 0;
+        orderManager.cancelOrderAsync(pending.orderId, [&pending](bool ok, const std::string&) {
+            pending.state = ok ? 1 : -1;
+        });
+        return await(pending);
+    }
+
+    typedef websocketpp::client<websocketpp::config::asio_client> Client;
+
+    // A real client on a loopback socket, so the broadcast path includes the frame
+    // write to a live connection. Its thread is uncounted: only the server side is under test.
+    class LoopbackSubscriber {
+    public:
+        LoopbackSubscriber(const std::string& uri, const std::string& symbol) {
+            m_client.clear_access_channels(websocketpp::log::alevel::all);
+            m_client.clear_error_channels(websocketpp::log::elevel::all);
+            m_client.init_asio();
+            m_client.set_open_handler([this, symbol](connection_hdl hdl) {
+                m_client.send(hdl, R"({"action":"subscribe","symbol":")" + symbol + R"("})", websocketpp::frame::opcode::text);
+            });
+            m_client.set_message_handler([this](connection_hdl, Client::message_ptr message) {
+                if (message->get_payload().find("\"result\"") != std::string::npos) {
+                    ++m_frames;
+                }
+            });
+            websocketpp::lib::error_code ec;
+            Client::connection_ptr connection = m_client.get_connection(uri, ec);
+            if (!ec) {
+                m_client.connect(connection);
+            }
+            m_thread = std::thread([this]() {
+                AllocationCheck::Uncounted uncounted;
+                m_client.run();
+            });
+        }
+
+        ~LoopbackSubscriber() {
+            m_client.stop();
+            m_thread.join();
+        }
+
+        uint64_t frames() const { return m_frames.load(); }
+
+    private:
+        Client m_client;
+        std::thread m_thread;
+        std::atomic<uint64_t> m_frames{0};
+    };
+
+    template <typename Condition>
+    bool waitFor(Condition condition) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // Warms the path up (thread-local buffers, pools and spare lists fill here), then counts
+    template <typename Step>
+    bool measure(const char* name, Step step) {
+        for (int i = 0; i < kWarmup; ++i) {
+            if (!step()) {
+                std::cerr << name << ": the loopback exchange did not answer" << std::endl;
+                return false;
+            }
+        }
+        uint64_t before = AllocationCheck::allocations();
+        for (int i = 0; i < kIterations; ++i) {
+            if (!step()) {
+                std::cerr << name << ": the loopback exchange did not answer" << std::endl;
+                return false;
+            }
+        }
+        uint64_t allocated = AllocationCheck::allocations() - before;
+        std::cout << name << ": " << allocated << " allocations in " << kIterations << " iterations" << std::endl;
+        return allocated == 0;
+    }
+}
+
+AllocationCheck::Uncounted::Uncounted() : m_previous(t_uncounted) {
+    t_uncounted = true;
+}
+
+AllocationCheck::Uncounted::~Uncounted() {
+    t_uncounted = m_previous;
+}
+
+bool AllocationCheck::countingEnabled() {
+#ifdef OEMS_ALLOCATION_COUNTING
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t AllocationCheck::allocations() {
+    return g_allocations.load(std::memory_order_relaxed);
+}
+
+int AllocationCheck::run() {
+    if (!countingEnabled()) {
+        std::cerr << "Allocation counting is not compiled in; configure with -DOEMS_ALLOCATION_COUNTING=ON." << std::endl;
+        return 2;
+    }
+
+    // Its thread is uncounted: only the client side is under test
+    LoopbackExchange exchange([](const std::function<void()>& serve) {
+        Uncounted uncounted;
+        serve();
+    });
+    bool clean = true;
+    {
+        // The stand-in speaks HTTP only
+        OrderManager orderManager({{"alloc-check", "alloc-check"}}, exchange.url(), nullptr, ExchangeSession::Transport::Http);
+        // The loopback exchange has no rate limit; the default tier would pace the loop to a few orders a second
+        orderManager.session().setRateLimits({1e12, 1e12, 1}, {1e12, 1e12, 1});
+        Pending pending;
+        pending.orderId.reserve(64);
+        clean = measure("place/cancel cycle", [&orderManager, &pending]() { return placeAndCancel(orderManager, pending); }) && clean;
+    }
+    {
+        // The server without its catalog and probe threads, so only the broadcast path runs
+        WebSocketHandler handler(exchange.url());
+        {
+            std::lock_guard<std::mutex> lock(handler.m_subscriptionMutex);
+            handler.m_subscriptions.intern("BTC-PERPETUAL", "future");
+        }
+        handler.m_instrumentsLoaded = true;
+        handler.m_server.clear_access_channels(websocketpp::log::alevel::all);
+        handler.m_server.clear_error_channels(websocketpp::log::elevel::all);
+        handler.m_server.listen(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        handler.m_server.start_accept();
+        websocketpp::lib::error_code ec;
+        uint16_t port = handler.m_server.get_local_endpoint(ec).port();
+        handler.m_running = true;
+        handler.m_serverThread = std::thread([&handler]() { handler.m_server.run(); });
+
+        LoopbackSubscriber subscriber("ws://127.0.0.1:" + std::to_string(port), "BTC-PERPETUAL");
+        bool subscribed = waitFor([&handler]() {
+            std::lock_guard<std::mutex> lock(handler.m_subscriptionMutex);
+            return handler.m_subscriptions.activeSymbols().size() == 1;
+        });
+        if (!subscribed) {
+            std::cerr << "broadcast tick: the loopback client did not subscribe" << std::endl;
+            clean = false;
+        } else {
+            // Each tick waits for its frame to arrive, so the written frame is back in the pool
+            clean = measure("broadcast tick", [&handler, &subscriber]() {
+                uint64_t received = subscriber.frames();
+                handler.broadcastTick();
+                return waitFor([&subscriber, received]() { return subscriber.frames() > received; });
+            }) && clean;
+        }
+    }
+
+    std::cout << (clean ? "Steady state is allocation-free." : "Steady state allocates; see the counts above.") << std::endl;
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+#include "depth_views.hpp"
+#include "memory_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+namespace {
+    constexpr double kEpsilon = 1e-9;
+
+    // Reads [[price, amount], ...] best first, skipping empty levels
+    template <typename Object, typename Levels, typename Better>
+    void readLevels(const Object& book, const char* side, Levels& out, Better better) {
+        out.clear();
+        if (!book.HasMember(side) || !book[side].IsArray()) {
+            return;
+        }
+        for (const auto& level : book[side].GetArray()) {
+            if (level.IsArray() && level.Size() >= 2 && level[0].IsNumber() && level[1].IsNumber() && level[1].GetDouble() > 0.0) {
+                out.push_back({level[0].GetDouble(), level[1].GetDouble()});
+            }
+        }
+        std::sort(out.begin(), out.end(), [&better](const auto& a, const auto& b) { return better(a.price, b.price); });
+    }
+
+    // Walks two best-first sides together and reports each price whose amount changed,
+    // with +1 or -1 levels when the price appeared or went away
+    template <typename Levels, typename Better, typename Apply>
+    void diffLevels(const Levels& before, const Levels& after, Better better, Apply apply) {
+        size_t i = 0;
+        size_t j = 0;
+        while (i < before.size() || j < after.size()) {
+            if (j == after.size() || (i < before.size() && better(before[i].price, after[j].price))) {
+                apply(before[i].price, -before[i].amount, -1);
+                ++i;
+            } else if (i == before.size() || better(after[j].price, before[i].price)) {
+                apply(after[j].price, after[j].amount, 1);
+                ++j;
+            } else {
+                if (after[j].amount != before[i].amount) {
+                    apply(after[j].price, after[j].amount - before[i].amount, 0);
+                }
+                ++i;
+                ++j;
+            }
+        }
+    }
+
+    bool higher(double a, double b) { return a > b; }
+    bool lower(double a, double b) { return a < b; }
+}
+
+bool DepthViews::viewName(const std::string& instrument, double grouping, size_t depth, std::string& name) {
+    if (instrument.empty() || instrument.find(':') != std::string::npos || !std::isfinite(grouping) ||
+        grouping < 0.0 || depth == 0 || depth > kMaxDepth) {
+        return false;
+    }
+    // %.10g so 5 and 5.0 name the same view
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.10g", grouping);
+    name = "depth." + instrument + ":" + text + ":" + std::to_string(depth);
+    return true;
+}
+
+bool DepthViews::viewInstrument(const std::string& name, std::string& instrument) {
+    View view;
+    std::string canonical;
+    // Only canonical names, so "5" and "5.0" cannot intern two entries for one view
+    if (!parseName(name, view) || !viewName(view.instrument, view.grouping, view.depth, canonical) || canonical != name) {
+        return false;
+    }
+    instrument = view.instrument;
+    return true;
+}
+
+bool DepthViews::parseName(const std::string& name, View& view) {
+    size_t depthSep = name.rfind(':');
+    if (!isView(name) || depthSep == std::string::npos || depthSep < 6) {
+        return false;
+    }
+    size_t groupingSep = name.rfind(':', depthSep - 1);
+    if (groupingSep == std::string::npos || groupingSep <= 6) {
+        return false;
+    }
+    view.name = name;
+    view.instrument = name.substr(6, groupingSep - 6);
+    view.grouping = std::strtod(name.c_str() + groupingSep + 1, nullptr);
+    view.depth = std::strtoul(name.c_str() + depthSep + 1, nullptr, 10);
+    return std::isfinite(view.grouping) && view.grouping >= 0.0 && view.depth > 0 && view.depth <= kMaxDepth;
+}
+
+// The epsilon keeps prices that sit exactly on a bin edge from falling into the next bin
+double DepthViews::bin(double price, double grouping, bool bid) {
+    if (grouping <= 0.0) {
+        return price;
+    }
+    double steps = bid ? std::floor(price / grouping + kEpsilon) : std::ceil(price / grouping - kEpsilon);
+    return std::round(steps * grouping * 1e8) / 1e8;
+}
+
+void DepthViews::addToBin(View& view, bool bid, double price, double delta, int levels) {
+    auto& side = bid ? view.bids : view.asks;
+    auto it = side.emplace(bin(price, view.grouping, bid), Bin()).first;
+    it->second.levels += levels;
+    it->second.size += delta;
+    if (it->second.levels == 0) {
+        side.erase(it);
+    }
+}
+
+void DepthViews::rebuild(View& view, const Source& source) {
+    view.bids.clear();
+    view.asks.clear();
+    for (const auto& level : source.bids) {
+        addToBin(view, true, level.price, level.amount, 1);
+    }
+    for (const auto& level : source.asks) {
+        addToBin(view, false, level.price, level.amount, 1);
+    }
+}
+
+std::vector<std::string> DepthViews::retain(const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::string> wanted(names);
+    std::sort(wanted.begin(), wanted.end());
+    for (auto it = m_views.begin(); it != m_views.end();) {
+        it = std::binary_search(wanted.begin(), wanted.end(), it->first) ? std::next(it) : m_views.erase(it);
+    }
+
+    std::vector<View*> created;
+    for (const auto& name : wanted) {
+        if (m_views.count(name) != 0) {
+            continue;
+        }
+        View view;
+        if (parseName(name, view)) {
+            created.push_back(&m_views.emplace(name, std::move(view)).first->second);
+        }
+    }
+
+    for (auto& entry : m_sources) {
+        entry.second.views.clear();
+    }
+    for (auto& entry : m_views) {
+        m_sources[entry.second.instrument].views.push_back(&entry.second);
+    }
+    // A new view on a watched instrument starts from its last book rather than waiting for a change
+    for (View* view : created) {
+        const Source& source = m_sources[view->instrument];
+        rebuild(*view, source);
+        refresh(*view, source);
+    }
+
+    std::vector<std::string> instruments;
+    for (auto it = m_sources.begin(); it != m_sources.end();) {
+        if (it->second.views.empty()) {
+            it = m_sources.erase(it);
+        } else {
+            instruments.push_back(it->first);
+            ++it;
+        }
+    }
+    std::sort(instruments.begin(), instruments.end());
+    return instruments;
+}
+
+void DepthViews::applyBook(const std::string& instrument, const std::string& frame) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_sources.count(instrument) == 0) {
+            return;
+        }
+    }
+
+    JsonArena::Document& doc = JsonArena::local().parse(frame);
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("result") || !doc["result"].IsObject()) {
+        return;
+    }
+    const auto& book = doc["result"];
+    int64_t changeId = (book.HasMember("change_id") && book["change_id"].IsInt64()) ? book["change_id"].GetInt64() : -1;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_sources.find(instrument);
+    if (it == m_sources.end()) {
+        return;
+    }
+    Source& source = it->second;
+    // Same change id, same book: nothing to do for any view
+    if (changeId >= 0 && changeId == source.changeId) {
+        return;
+    }
+
+    readLevels(book, "bids", m_nextBids, higher);
+    readLevels(book, "asks", m_nextAsks, lower);
+    diffLevels(source.bids, m_nextBids, higher, [&source](double price, double delta, int levels) {
+        for (View* view : source.views) {
+            addToBin(*view, true, price, delta, levels);
+        }
+    });
+    diffLevels(source.asks, m_nextAsks, lower, [&source](double price, double delta, int levels) {
+        for (View* view : source.views) {
+            addToBin(*view, false, price, delta, levels);
+        }
+    });
+    source.bids.swap(m_nextBids);
+    source.asks.swap(m_nextAsks);
+    source.changeId = changeId;
+    source.loaded = true;
+    source.timestamp = (book.HasMember("timestamp") && book["timestamp"].IsInt64()) ? book["timestamp"].GetInt64() : 0;
+
+    for (View* view : source.views) {
+        refresh(*view, source);
+    }
+}
+
+// Re-encodes only when the bins a client can see differ from the last frame
+void DepthViews::refresh(View& view, const Source& source) {
+    if (!source.loaded) {
+        return;
+    }
+
+    bool changed = view.frame.empty();
+    m_visible.clear();
+    for (auto it = view.bids.rbegin(); it != view.bids.rend() && m_visible.size() < view.depth; ++it) {
+        m_visible.push_back({it->first, it->second.size});
+    }
+    if (m_visible != view.shownBids) {
+        view.shownBids.swap(m_visible);
+        changed = true;
+    }
+    m_visible.clear();
+    for (auto it = view.asks.begin(); it != view.asks.end() && m_visible.size() < view.depth; ++it) {
+        m_visible.push_back({it->first, it->second.size});
+    }
+    if (m_visible != view.shownAsks) {
+        view.shownAsks.swap(m_visible);
+        changed = true;
+    }
+
+    if (changed) {
+        encode(view, source);
+        ++view.version;
+    }
+}
+
+void DepthViews::encode(View& view, const Source& source) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("depth");
+    writer.Key("view");
+    writer.String(view.name.c_str());
+    writer.Key("instrument_name");
+    writer.String(view.instrument.c_str());
+    writer.Key("grouping");
+    writer.Double(view.grouping);
+    writer.Key("depth");
+    writer.Uint64(view.depth);
+    writer.Key("change_id");
+    writer.Int64(source.changeId);
+    writer.Key("timestamp");
+    writer.Int64(source.timestamp);
+    // [price, size, cumulative size from the top of the book]
+    auto writeSide = [&writer](const char* key, const std::vector<Level>& levels) {
+        writer.Key(key);
+        writer.StartArray();
+        double cumulative = 0.0;
+        for (const auto& level : levels) {
+            cumulative += level.amount;
+            writer.StartArray();
+            writer.Double(level.price);
+            writer.Double(level.amount);
+            writer.Double(cumulative);
+            writer.EndArray();
+        }
+        writer.EndArray();
+    };
+    writeSide("bids", view.shownBids);
+    writeSide("asks", view.shownAsks);
+    writer.EndObject();
+    view.frame.assign(buffer.GetString(), buffer.GetSize());
+}
+
+bool DepthViews::frameSince(const std::string& name, uint64_t& version, std::string& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_views.find(name);
+    if (it == m_views.end() || it->second.frame.empty() || it->second.version == version) {
+        return false;
+    }
+    out.assign(it->second.frame);
+    version = it->second.version;
+    return true;
+}
+
+std::string DepthViews::latest(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_views.find(name);
+    return it == m_views.end() ? std::string() : it->second.frame;
+}
@@ -0,0 +1,778 @@
+#include "exchange_session.hpp"
+#include "memory_pool.hpp"
+#include "utils.hpp"
+#include <curl/curl.h>
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+namespace {
+
+    // Everything here outlives one request: the buffers keep their capacity and the
+    // header list is only rebuilt when the access token changes.
+    struct Transfer {
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        std::string headersToken;
+        std::string authorization;
+        std::string url;
+        std::string payload;
+        std::string response;
+        RateLimitScheduler::Request request;
+        bool busy = false;
+    };
+
+    size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* s) {
+        size_t newLength = size * nmemb;
+        s->append((char*)contents, newLength);
+        return newLength;
+    }
+
+    void complete(std::vector<ExchangeSession::ResponseCallback>& callbacks, bool ok, const std::string& response) {
+        for (auto& callback : callbacks) {
+            try {
+                callback(ok, response);
+            } catch (const std::exception& e) {
+                std::cerr << "Exchange session callback error: " << e.what() << std::endl;
+            }
+        }
+        callbacks.clear();
+    }
+
+    // Deribit error 10028: too_many_requests. Successful responses have no "error" key, so
+    // only those that might be errors are parsed (into the worker's arena).
+    bool isRateLimited(const std::string& response) {
+        if (response.find("\"error\"") == std::string::npos) {
+            return false;
+        }
+        JsonArena::Document& doc = JsonArena::local().parse(response);
+        if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("error") || !doc["error"].IsObject()) {
+            return false;
+        }
+        const auto& error = doc["error"];
+        return error.HasMember("code") && error["code"].IsInt64() && error["code"].GetInt64() == 10028;
+    }
+
+    void appendCall(std::string& out, uint64_t id, const std::string& method, const std::string& params) {
+        out.assign("{\"jsonrpc\":\"2.0\", \"id\":");
+        UtilityNamespace::appendNumber(out, static_cast<int64_t>(id));
+        out.append(", \"method\":\"").append(method).append("\", \"params\":").append(params).append("}");
+    }
+
+    bool parseAuth(const std::string& response, std::string& accessToken, int64_t& expiresIn) {
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("result") || !doc["result"].IsObject() ||
+            !doc["result"].HasMember("access_token") || !doc["result"]["access_token"].IsString()) {
+            return false;
+        }
+        const auto& result = doc["result"];
+        accessToken = result["access_token"].GetString();
+        expiresIn = (result.HasMember("expires_in") && result["expires_in"].IsInt64()) ? result["expires_in"].GetInt64() : 900;
+        return true;
+    }
+
+    // wss://host/ws/api/v2 for https://host/api/v2
+    std::string socketUrl(const std::string& baseUrl) {
+        size_t scheme = baseUrl.find("://");
+        if (scheme == std::string::npos) {
+            return baseUrl;
+        }
+        size_t path = baseUrl.find('/', scheme + 3);
+        std::string host = baseUrl.substr(scheme, path == std::string::npos ? std::string::npos : path - scheme);
+        return (baseUrl.compare(0, scheme, "https") == 0 ? "wss" : "ws") + host + "/ws" +
+               (path == std::string::npos ? std::string("/api/v2") : baseUrl.substr(path));
+    }
+
+    // One call on the persistent connection, waiting for its reply
+    struct SocketCall {
+        RateLimitScheduler::Request request;
+        bool busy = false;
+    };
+
+    // Sleeps until the socket is ready, the session is woken by submit() or stop(), or the timeout passes
+    void waitSocket(CURLM* multi, CURL* socket, short events, int timeoutMs) {
+        curl_socket_t fd = CURL_SOCKET_BAD;
+        curl_easy_getinfo(socket, CURLINFO_ACTIVESOCKET, &fd);
+        curl_waitfd waitfd{fd, events, 0};
+        curl_multi_poll(multi, &waitfd, fd == CURL_SOCKET_BAD ? 0 : 1, timeoutMs, nullptr);
+    }
+
+    bool sendText(CURLM* multi, CURL* socket, const std::string& text) {
+        size_t offset = 0;
+        while (offset < text.size()) {
+            size_t sent = 0;
+            CURLcode result = curl_ws_send(socket, text.data() + offset, text.size() - offset, &sent, 0, CURLWS_TEXT);
+            offset += sent;
+            if (result == CURLE_AGAIN) {
+                waitSocket(multi, socket, CURL_WAIT_POLLOUT, 100);
+            } else if (result != CURLE_OK) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Reads what has arrived into message; true once message holds a whole text message.
+    // Pings are answered by libcurl itself.
+    CURLcode receiveText(CURL* socket, std::vector<char>& buffer, std::string& message, bool& whole) {
+        whole = false;
+        while (!whole) {
+            size_t received = 0;
+            const curl_ws_frame* frame = nullptr;
+            CURLcode result = curl_ws_recv(socket, buffer.data(), buffer.size(), &received, &frame);
+            if (result != CURLE_OK) {
+                return result;
+            }
+            if (frame->flags & CURLWS_CLOSE) {
+                return CURLE_RECV_ERROR;
+            }
+            if (frame->flags & (CURLWS_PING | CURLWS_PONG)) {
+                continue;
+            }
+            message.append(buffer.data(), received);
+            whole = frame->bytesleft == 0 && !(frame->flags & CURLWS_CONT);
+        }
+        return CURLE_OK;
+    }
+
+    uint64_t replyId(const std::string& message, bool& testRequest) {
+        testRequest = false;
+        JsonArena::Document& doc = JsonArena::local().parse(message);
+        if (doc.HasParseError() || !doc.IsObject()) {
+            return 0;
+        }
+        if (doc.HasMember("id") && doc["id"].IsUint64()) {
+            return doc["id"].GetUint64();
+        }
+        testRequest = doc.HasMember("method") && doc["method"].IsString() && std::strcmp(doc["method"].GetString(), "heartbeat") == 0 &&
+                      doc.HasMember("params") && doc["params"].IsObject() && doc["params"].HasMember("type") &&
+                      doc["params"]["type"].IsString() && std::strcmp(doc["params"]["type"].GetString(), "test_request") == 0;
+        return 0;
+    }
+}
+
+ExchangeSession::ExchangeSession(const std::string& clientId, const std::string& clientSecret, const std::string& baseUrl, Transport transport)
+    : m_clientId(clientId), m_clientSecret(clientSecret), m_baseUrl(baseUrl), m_transport(transport), m_multi(nullptr),
+      m_running(false), m_connected(transport == Transport::Http), m_nextId(1), m_inFlight(0), m_requestsSent(0) {}
+
+ExchangeSession::~ExchangeSession() {
+    stop();
+}
+
+void ExchangeSession::start() {
+    if (m_running.exchange(true)) {
+        return;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    // Authenticate up front so the first order does not pay for it; a WebSocket authenticates as it connects
+    if (m_transport == Transport::Http && tokenNeedsRefresh()) {
+        try {
+            refreshToken();
+        } catch (const std::exception& e) {
+            std::cerr << "Exchange session pre-authentication failed: " << e.what() << std::endl;
+        }
+    }
+
+    m_worker = std::thread([this]() {
+        if (m_transport == Transport::WebSocket) {
+            runSocket();
+        } else {
+            run();
+        }
+    });
+}
+
+void ExchangeSession::stop() {
+    if (!m_running.exchange(false)) {
+        return;
+    }
+
+    m_queueCv.notify_all();
+    curl_multi_wakeup(m_multi);
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+
+    std::vector<RateLimitScheduler::Request> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        abandoned = m_scheduler.drain();
+    }
+    for (auto& request : abandoned) {
+        complete(request.callbacks, false, R"({"error": "Exchange session stopped"})");
+    }
+
+    curl_multi_cleanup(m_multi);
+    m_multi = nullptr;
+    curl_global_cleanup();
+}
+
+uint64_t ExchangeSession::submit(const std::string& method, const std::string& params, ResponseCallback callback, const std::string& orderId) {
+    RateLimitScheduler::Request request;
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        if (!m_spareRequests.empty()) {
+            request = std::move(m_spareRequests.back());
+            m_spareRequests.pop_back();
+        }
+    }
+    request.id = m_nextId++;
+    request.method.assign(method);
+    request.params.assign(params);
+    request.orderId.assign(orderId);
+    request.callbacks.push_back(std::move(callback));
+    uint64_t id = request.id;
+
+    std::vector<ResponseCallback> dropped;
+    bool running;
+    {
+        // Checked under the queue lock: stop() drains under it, so nothing is queued after the drain
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        running = m_running;
+        if (running) {
+            dropped = m_scheduler.enqueue(std::move(request), RateLimitScheduler::Clock::now());
+        }
+    }
+    if (!running) {
+        complete(request.callbacks, false, R"({"error": "Exchange session stopped"})");
+        recycle(request);
+        return id;
+    }
+    if (!dropped.empty()) {
+        complete(dropped, false, R"({"error": "Superseded by a newer request for the same order"})");
+    }
+
+    m_queueCv.notify_one();
+    if (m_multi) {
+        curl_multi_wakeup(m_multi);
+    }
+    return id;
+}
+
+std::string ExchangeSession::call(const std::string& method, const std::string& params, const std::string& orderId) {
+    auto promise = std::make_shared<std::promise<std::pair<bool, std::string>>>();
+    auto future = promise->get_future();
+    submit(method, params, [promise](bool ok, const std::string& response) {
+        promise->set_value({ok, response});
+    }, orderId);
+
+    auto [ok, response] = future.get();
+    if (!ok) {
+        throw std::runtime_error(response);
+    }
+    return response;
+}
+
+void ExchangeSession::discardQueuedOrderFlow() {
+    std::vector<ResponseCallback> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        dropped = m_scheduler.discardOrderFlow();
+    }
+    complete(dropped, false, R"({"error": "Cancelled by kill switch"})");
+}
+
+RateLimitScheduler::Stats ExchangeSession::schedulerStats() {
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    return m_scheduler.stats(RateLimitScheduler::Clock::now());
+}
+
+void ExchangeSession::setRateLimits(RateLimitScheduler::Limits matching, RateLimitScheduler::Limits nonMatching) {
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    m_scheduler.setLimits(matching, nonMatching);
+}
+
+int64_t ExchangeSession::tokenExpiresAtMs() {
+    std::lock_guard<std::mutex> lock(m_tokenMutex);
+    if (m_accessToken.empty()) {
+        return 0;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(m_tokenExpiry - std::chrono::steady_clock::now());
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() + remaining.count();
+}
+
+bool ExchangeSession::tokenNeedsRefresh() const {
+    return m_accessToken.empty() || std::chrono::steady_clock::now() + std::chrono::seconds(60) >= m_tokenExpiry;
+}
+
+std::string ExchangeSession::authParams() const {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("grant_type");
+    writer.String("client_credentials");
+    writer.Key("client_id");
+    writer.String(m_clientId.c_str());
+    writer.Key("client_secret");
+    writer.String(m_clientSecret.c_str());
+    writer.EndObject();
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void ExchangeSession::refreshToken() {
+    std::string payload = "{\"jsonrpc\":\"2.0\", \"method\":\"public/auth\", \"params\":" + authParams() + ", \"id\":0}";
+    std::string response = UtilityNamespace::sendPostRequest(m_baseUrl + "/public/auth", payload);
+    std::string accessToken;
+    int64_t expiresIn = 0;
+    if (!parseAuth(response, accessToken, expiresIn)) {
+        throw std::runtime_error("Authentication failed.");
+    }
+    storeToken(accessToken, expiresIn);
+}
+
+void ExchangeSession::storeToken(const std::string& accessToken, int64_t expiresIn) {
+    std::lock_guard<std::mutex> lock(m_tokenMutex);
+    m_accessToken = accessToken;
+    m_tokenExpiry = std::chrono::steady_clock::now() + std::chrono::seconds(expiresIn);
+}
+
+// Completed requests go back to the spare list with their callbacks cleared, so the
+// next submit() reuses their strings and callback storage
+void ExchangeSession::recycle(RateLimitScheduler::Request& request) {
+    request.callbacks.clear();
+    std::lock_guard<std::mutex> lock(m_queueMutex);
+    if (m_spareRequests.size() < kMaxSpareRequests) {
+        m_spareRequests.push_back(std::move(request));
+    }
+}
+
+// Takes what the rate-limit budget allows, sleeping first when asked and nothing is in flight
+void ExchangeSession::pullBatch(std::vector<RateLimitScheduler::Request>& batch, size_t active, bool wait) {
+    batch.clear();
+    std::unique_lock<std::mutex> lock(m_queueMutex);
+    if (wait && active == 0) {
+        // Sleep until work arrives or, if work is queued, until the bucket can pay for it
+        auto delay = m_scheduler.empty() ? std::chrono::milliseconds(100)
+                                         : std::chrono::duration_cast<std::chrono::milliseconds>(m_scheduler.waitTime(RateLimitScheduler::Clock::now()));
+        if (delay.count() > 0) {
+            m_queueCv.wait_for(lock, std::min(delay, std::chrono::milliseconds(100)));
+        }
+    }
+    auto now = RateLimitScheduler::Clock::now();
+    // An idle HTTP connection goes cold; the WebSocket is kept alive by heartbeats instead
+    if (m_transport == Transport::Http && active == 0 && m_scheduler.empty() && now - m_lastSent >= kKeepAliveInterval) {
+        RateLimitScheduler::Request keepAlive;
+        keepAlive.id = m_nextId++;
+        keepAlive.method = "public/test";
+        keepAlive.params = "{}";
+        m_scheduler.enqueue(std::move(keepAlive), now);
+    }
+    RateLimitScheduler::Request request;
+    while (active + batch.size() < kMaxInFlight && m_scheduler.next(request, now)) {
+        batch.push_back(std::move(request));
+    }
+}
+
+// A rate-limited reply goes back to the scheduler; anything else is observed and delivered
+void ExchangeSession::finish(RateLimitScheduler::Request& request, bool ok, const std::string& response) {
+    if (ok && isRateLimited(response)) {
+        // Our credit model drifted from the exchange's: empty the bucket and try again once it refills
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_scheduler.onRateLimited(request.method, RateLimitScheduler::Clock::now());
+        m_scheduler.retry(std::move(request));
+        return;
+    }
+    if (m_observer) {
+        m_observer(request, ok, response);
+    }
+    complete(request.callbacks, ok, response);
+    recycle(request);
+}
+
+void ExchangeSession::run() {
+    CURLM* multi = m_multi;
+    std::vector<std::unique_ptr<Transfer>> pool;
+    std::vector<RateLimitScheduler::Request> batch;
+    size_t active = 0;
+
+    while (m_running) {
+        pullBatch(batch, active, true);
+
+        // Refresh ahead of expiry even when idle, so an urgent cancel never waits on authentication
+        if (tokenNeedsRefresh() && (!batch.empty() || std::chrono::steady_clock::now() >= m_authRetryAt)) {
+            try {
+                refreshToken();
+            } catch (const std::exception& e) {
+                m_authRetryAt = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                for (auto& request : batch) {
+                    complete(request.callbacks, false, std::string(R"({"error": ")") + e.what() + "\"}");
+                }
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            m_lastSent = std::chrono::steady_clock::now();
+        }
+
+        for (auto& request : batch) {
+            Transfer* transfer = nullptr;
+            for (auto& candidate : pool) {
+                if (!candidate->busy) {
+                    transfer = candidate.get();
+                    break;
+                }
+            }
+            if (!transfer) {
+                pool.push_back(std::make_unique<Transfer>());
+                transfer = pool.back().get();
+                transfer->easy = curl_easy_init();
+            }
+
+            transfer->busy = true;
+            transfer->request = std::move(request);
+            const RateLimitScheduler::Request& sent = transfer->request;
+            appendCall(transfer->payload, sent.id, sent.method, sent.params);
+            transfer->response.clear();
+            if (!transfer->headers || transfer->headersToken != m_accessToken) {
+                curl_slist_free_all(transfer->headers);
+                transfer->authorization.assign("Authorization: Bearer ").append(m_accessToken);
+                transfer->headers = curl_slist_append(nullptr, "Content-Type: application/json");
+                transfer->headers = curl_slist_append(transfer->headers, transfer->authorization.c_str());
+                transfer->headersToken = m_accessToken;
+            }
+
+            transfer->url.assign(m_baseUrl).append("/").append(sent.method);
+            curl_easy_setopt(transfer->easy, CURLOPT_URL, transfer->url.c_str());
+            curl_easy_setopt(transfer->easy, CURLOPT_HTTPHEADER, transfer->headers);
+            curl_easy_setopt(transfer->easy, CURLOPT_POSTFIELDS, transfer->payload.c_str());
+            curl_easy_setopt(transfer->easy, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(transfer->easy, CURLOPT_WRITEDATA, &transfer->response);
+            curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+            curl_easy_setopt(transfer->easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(transfer->easy, CURLOPT_PIPEWAIT, 1L);
+            curl_multi_add_handle(multi, transfer->easy);
+
+            ++active;
+            ++m_inFlight;
+            ++m_requestsSent;
+        }
+
+        if (active == 0) {
+            continue;
+        }
+
+        int stillRunning = 0;
+        curl_multi_perform(multi, &stillRunning);
+
+        CURLMsg* msg;
+        int remaining;
+        while ((msg = curl_multi_info_read(multi, &remaining))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            Transfer* transfer = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi, transfer->easy);
+            transfer->busy = false;
+            --active;
+            --m_inFlight;
+
+            if (result != CURLE_OK) {
+                finish(transfer->request, false, std::string(R"({"error": ")") + curl_easy_strerror(result) + "\"}");
+            } else {
+                finish(transfer->request, true, transfer->response);
+            }
+        }
+
+        if (stillRunning > 0) {
+            curl_multi_poll(multi, nullptr, 0, 10, nullptr);
+        }
+    }
+
+    for (auto& transfer : pool) {
+        if (transfer->busy) {
+            curl_multi_remove_handle(multi, transfer->easy);
+            --m_inFlight;
+            complete(transfer->request.callbacks, false, R"({"error": "Exchange session stopped before the reply; outcome unknown"})");
+        }
+        curl_slist_free_all(transfer->headers);
+        curl_easy_cleanup(transfer->easy);
+    }
+}
+
+void* ExchangeSession::openSocket() {
+    CURL* socket = curl_easy_init();
+    std::string url = socketUrl(m_baseUrl);
+    curl_easy_setopt(socket, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(socket, CURLOPT_CONNECT_ONLY, 2L);
+    curl_easy_setopt(socket, CURLOPT_CONNECTTIMEOUT, static_cast<long>(kHandshakeTimeout.count()));
+
+    // Nothing else is sent until the exchange has agreed to pull this connection's orders if it drops
+    std::string response;
+    std::string accessToken;
+    int64_t expiresIn = 0;
+    std::string error;
+    CURLcode result = curl_easy_perform(socket);
+    if (result != CURLE_OK) {
+        error = curl_easy_strerror(result);
+    } else if (!handshake(socket, "public/auth", authParams(), response) || !parseAuth(response, accessToken, expiresIn)) {
+        error = "authentication failed " + response;
+    } else {
+        storeToken(accessToken, expiresIn);
+        if (!handshake(socket, "private/enable_cancel_on_disconnect", R"({"scope":"connection"})", response) ||
+            response.find("\"error\"") != std::string::npos) {
+            error = "could not enable cancel-on-disconnect " + response;
+        } else if (!handshake(socket, "public/set_heartbeat", "{\"interval\":" + std::to_string(kHeartbeatSeconds) + "}", response) ||
+                   response.find("\"error\"") != std::string::npos) {
+            error = "could not enable heartbeats " + response;
+        }
+    }
+
+    if (!error.empty()) {
+        std::cerr << "Exchange connection to " << url << " failed: " << error << std::endl;
+        curl_easy_cleanup(socket);
+        return nullptr;
+    }
+    return socket;
+}
+
+void ExchangeSession::closeSocket(void* socket) {
+    size_t sent = 0;
+    curl_ws_send(static_cast<CURL*>(socket), "", 0, &sent, 0, CURLWS_CLOSE);
+    curl_easy_cleanup(static_cast<CURL*>(socket));
+}
+
+bool ExchangeSession::handshake(void* socket, const std::string& method, const std::string& params, std::string& response) {
+    CURL* easy = static_cast<CURL*>(socket);
+    uint64_t id = m_nextId++;
+    std::string payload;
+    appendCall(payload, id, method, params);
+    if (!sendText(m_multi, easy, payload)) {
+        return false;
+    }
+
+    std::vector<char> buffer(16384);
+    response.clear();
+    auto deadline = std::chrono::steady_clock::now() + kHandshakeTimeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        bool whole = false;
+        CURLcode result = receiveText(easy, buffer, response, whole);
+        if (result == CURLE_AGAIN) {
+            waitSocket(m_multi, easy, CURL_WAIT_POLLIN, 100);
+            continue;
+        }
+        if (result != CURLE_OK) {
+            return false;
+        }
+        bool testRequest = false;
+        if (replyId(response, testRequest) == id) {
+            return true;
+        }
+        response.clear();
+    }
+    return false;
+}
+
+// WebSocket transport: every call goes out on one connection and replies are matched
+// to their call by id. Calls on the wire when the connection drops fail (the exchange
+// has already pulled the orders that connection placed); queued calls wait for the reconnect.
+void ExchangeSession::runSocket() {
+    CURLM* multi = m_multi;
+    std::vector<SocketCall> calls(kMaxInFlight);
+    std::vector<RateLimitScheduler::Request> batch;
+    std::vector<char> buffer(16384);
+    std::string payload;
+    std::string message;
+    CURL* socket = nullptr;
+    size_t active = 0;
+    uint64_t authId = 0;
+    std::chrono::seconds reconnectDelay{1};
+    auto reconnectAt = std::chrono::steady_clock::now();
+    auto lastReceived = reconnectAt;
+
+    auto failCalls = [&](const std::string& error) {
+        for (auto& call : calls) {
+            if (call.busy) {
+                call.busy = false;
+                --active;
+                --m_inFlight;
+                finish(call.request, false, error);
+            }
+        }
+    };
+    auto completeCall = [&](uint64_t id, const std::string& reply) {
+        for (auto& call : calls) {
+            if (call.busy && call.request.id == id) {
+                call.busy = false;
+                --active;
+                --m_inFlight;
+                finish(call.request, true, reply);
+                break;
+            }
+        }
+    };
+    auto dropConnection = [&](const char* reason) {
+        std::cerr << "Exchange connection lost: " << reason << std::endl;
+        curl_easy_cleanup(socket);
+        socket = nullptr;
+        authId = 0;
+        message.clear();
+        m_connected = false;
+        if (m_connectionObserver) {
+            m_connectionObserver(false);
+        }
+        failCalls(R"({"error": "Exchange connection lost"})");
+        reconnectAt = std::chrono::steady_clock::now() + reconnectDelay;
+    };
+
+    while (m_running) {
+        auto now = std::chrono::steady_clock::now();
+        if (!socket) {
+            // New orders and edits are not held for a connection that may take a while to come back
+            std::vector<ResponseCallback> dropped;
+            {
+                std::unique_lock<std::mutex> lock(m_queueMutex);
+                dropped = m_scheduler.discardOrderFlow();
+                if (dropped.empty() && now < reconnectAt) {
+                    m_queueCv.wait_for(lock, std::min<std::chrono::steady_clock::duration>(reconnectAt - now, std::chrono::milliseconds(100)));
+                }
+            }
+            complete(dropped, false, R"({"error": "Not connected to the exchange"})");
+            if (std::chrono::steady_clock::now() < reconnectAt || !m_running) {
+                continue;
+            }
+            socket = static_cast<CURL*>(openSocket());
+            if (!socket) {
+                reconnectAt = std::chrono::steady_clock::now() + reconnectDelay;
+                reconnectDelay = std::min(reconnectDelay * 2, kMaxReconnectDelay);
+                continue;
+            }
+            reconnectDelay = std::chrono::seconds(1);
+            lastReceived = std::chrono::steady_clock::now();
+            m_connected = true;
+            if (m_connectionObserver) {
+                m_connectionObserver(true);
+            }
+            continue;
+        }
+
+        if (now - lastReceived > std::chrono::seconds(3 * kHeartbeatSeconds)) {
+            dropConnection("no heartbeat from the exchange");
+            continue;
+        }
+
+        // The connection stays authenticated only while its token does, so renew it ahead of expiry
+        if (authId == 0 && tokenNeedsRefresh() && now >= m_authRetryAt) {
+            authId = m_nextId++;
+            appendCall(payload, authId, "public/auth", authParams());
+            if (!sendText(multi, socket, payload)) {
+                dropConnection("send failed");
+                continue;
+            }
+        }
+
+        pullBatch(batch, active, false);
+        bool lost = false;
+        for (auto& request : batch) {
+            auto call = std::find_if(calls.begin(), calls.end(), [](const SocketCall& candidate) { return !candidate.busy; });
+            call->busy = true;
+            call->request = std::move(request);
+            ++active;
+            ++m_inFlight;
+            ++m_requestsSent;
+            appendCall(payload, call->request.id, call->request.method, call->request.params);
+            // Calls after a failed send stay busy and fail with the rest when the connection is dropped
+            lost = lost || !sendText(multi, socket, payload);
+        }
+        if (lost) {
+            dropConnection("send failed");
+            continue;
+        }
+
+        while (!lost) {
+            bool whole = false;
+            CURLcode result = receiveText(socket, buffer, message, whole);
+            if (result == CURLE_AGAIN) {
+                break;
+            }
+            if (result != CURLE_OK) {
+                lost = true;
+                break;
+            }
+            lastReceived = std::chrono::steady_clock::now();
+
+            bool testRequest = false;
+            uint64_t id = replyId(message, testRequest);
+            if (testRequest) {
+                appendCall(payload, m_nextId++, "public/test", "{}");
+                lost = !sendText(multi, socket, payload);
+            } else if (id != 0 && id == authId) {
+                std::string accessToken;
+                int64_t expiresIn = 0;
+                if (parseAuth(message, accessToken, expiresIn)) {
+                    storeToken(accessToken, expiresIn);
+                } else {
+                    std::cerr << "Exchange re-authentication failed: " << message << std::endl;
+                    m_authRetryAt = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                }
+                authId = 0;
+            } else if (id != 0) {
+                completeCall(id, message);
+            }
+            message.clear();
+        }
+        if (lost) {
+            dropConnection("connection closed");
+            continue;
+        }
+
+        int timeoutMs = 100;
+        if (active < kMaxInFlight) {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            if (!m_scheduler.empty()) {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(m_scheduler.waitTime(RateLimitScheduler::Clock::now()));
+                timeoutMs = static_cast<int>(std::min<int64_t>(wait.count(), timeoutMs));
+            }
+        }
+        waitSocket(multi, socket, CURL_WAIT_POLLIN, timeoutMs);
+    }
+
+    if (socket) {
+        // Calls on the wire may already have executed: wait for their replies before the
+        // handshake below, which would read past them
+        auto deadline = std::chrono::steady_clock::now() + kHandshakeTimeout;
+        bool open = true;
+        while (active > 0 && std::chrono::steady_clock::now() < deadline) {
+            bool whole = false;
+            CURLcode result = receiveText(socket, buffer, message, whole);
+            if (result == CURLE_AGAIN) {
+                waitSocket(multi, socket, CURL_WAIT_POLLIN, 100);
+                continue;
+            }
+            if (result != CURLE_OK) {
+                open = false;
+                break;
+            }
+            bool testRequest = false;
+            uint64_t id = replyId(message, testRequest);
+            if (id != 0 && id != authId) {
+                completeCall(id, message);
+            }
+            message.clear();
+        }
+        // A planned stop leaves resting orders in place for a warm restart; only a lost connection pulls them
+        if (open) {
+            std::string response;
+            handshake(socket, "private/disable_cancel_on_disconnect", R"({"scope":"connection"})", response);
+            closeSocket(socket);
+        } else {
+            curl_easy_cleanup(socket);
+        }
+    }
+    m_connected = false;
+    // Still unanswered: they may or may not have reached the exchange
+    failCalls(R"({"error": "Exchange session stopped before the reply; outcome unknown"})");
+}
@@ -0,0 +1,323 @@
+#include "latency_monitor.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+size_t LatencyHistogram::bucketOf(int64_t micros) {
+    uint64_t value = static_cast<uint64_t>(std::min<int64_t>(std::max<int64_t>(micros, 0), (int64_t(1) << 40) - 1));
+    if (value < kLinear) {
+        return static_cast<size_t>(value);
+    }
+    int msb = 4;
+    while ((value >> (msb + 1)) != 0) {
+        ++msb;
+    }
+    size_t sub = (value >> (msb - kSubBits)) & ((1 << kSubBits) - 1);
+    return kLinear + static_cast<size_t>(msb - 4) * (1 << kSubBits) + sub;
+}
+
+int64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    if (bucket < kLinear) {
+        return static_cast<int64_t>(bucket);
+    }
+    int msb = 4 + static_cast<int>((bucket - kLinear) >> kSubBits);
+    int64_t sub = static_cast<int64_t>((bucket - kLinear) & ((1 << kSubBits) - 1));
+    int64_t width = int64_t(1) << (msb - kSubBits);
+    return ((int64_t(1) << kSubBits) + sub) * width + width - 1;
+}
+
+void LatencyHistogram::record(int64_t micros) {
+    micros = std::max<int64_t>(micros, 0);
+    ++m_buckets[bucketOf(micros)];
+    ++m_count;
+    m_sum += micros;
+    m_max = std::max(m_max, micros);
+}
+
+int64_t LatencyHistogram::percentile(double q) const {
+    if (m_count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * m_count)));
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+        seen += m_buckets[bucket];
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(bucket), m_max);
+        }
+    }
+    return m_max;
+}
+
+int64_t LatencyMonitor::nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+LatencyMonitor::Connection& LatencyMonitor::connection(websocketpp::connection_hdl hdl) {
+    auto [it, inserted] = m_connections.try_emplace(hdl);
+    if (inserted) {
+        it->second.stats.connectionId = m_nextConnectionId++;
+    }
+    return it->second;
+}
+
+// Probes that never came back count as lost; bounding the maps keeps a silent client cheap
+void LatencyMonitor::expireProbes(Connection& connection) {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = connection.pendingPings.begin(); it != connection.pendingPings.end();) {
+        bool expired = now - it->second > std::chrono::microseconds(kProbeTimeoutMicros);
+        if (expired || connection.pendingPings.size() > kMaxPendingProbes) {
+            ++connection.stats.lostProbes;
+            it = connection.pendingPings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    int64_t wallNow = nowMicros();
+    for (auto it = connection.pendingSyncs.begin(); it != connection.pendingSyncs.end();) {
+        bool expired = wallNow - it->second > kProbeTimeoutMicros;
+        if (expired || connection.pendingSyncs.size() > kMaxPendingProbes) {
+            ++connection.stats.lostProbes;
+            it = connection.pendingSyncs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+std::string LatencyMonitor::beginPing(websocketpp::connection_hdl hdl) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Connection& state = connection(hdl);
+    expireProbes(state);
+    uint64_t id = m_nextProbeId++;
+    state.pendingPings.emplace(id, std::chrono::steady_clock::now());
+    return std::to_string(id);
+}
+
+bool LatencyMonitor::onPong(websocketpp::connection_hdl hdl, const std::string& payload) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t id = std::strtoull(payload.c_str(), nullptr, 10);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(hdl);
+    if (it == m_connections.end()) {
+        return false;
+    }
+    auto probe = it->second.pendingPings.find(id);
+    if (probe == it->second.pendingPings.end()) {
+        return false;
+    }
+    it->second.stats.rtt.record(std::chrono::duration_cast<std::chrono::microseconds>(now - probe->second).count());
+    it->second.pendingPings.erase(probe);
+    return true;
+}
+
+std::string LatencyMonitor::beginTimeSync(websocketpp::connection_hdl hdl) {
+    uint64_t id;
+    int64_t t1;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Connection& state = connection(hdl);
+        expireProbes(state);
+        state.timeSync = true;
+        id = m_nextProbeId++;
+        t1 = nowMicros();
+        state.pendingSyncs.emplace(id, t1);
+    }
+    return "{\"type\":\"time_sync\",\"id\":" + std::to_string(id) + ",\"t1\":" + std::to_string(t1) + "}";
+}
+
+bool LatencyMonitor::onTimeSync(websocketpp::connection_hdl hdl, uint64_t id, int64_t t1, int64_t t2, int64_t t3) {
+    int64_t t4 = nowMicros();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(hdl);
+    if (it == m_connections.end()) {
+        return false;
+    }
+    Connection& state = it->second;
+    auto probe = state.pendingSyncs.find(id);
+    // The echoed t1 must be the one we sent, so a client cannot forge samples for other probes
+    if (probe == state.pendingSyncs.end() || probe->second != t1) {
+        return false;
+    }
+    state.pendingSyncs.erase(probe);
+
+    OffsetSample sample{((t2 - t1) + (t3 - t4)) / 2, (t4 - t1) - (t3 - t2)};
+    if (sample.delay < 0) {
+        return false;
+    }
+    if (state.offsets.size() < kOffsetWindow) {
+        state.offsets.push_back(sample);
+    } else {
+        state.offsets[state.nextOffset] = sample;
+    }
+    state.nextOffset = (state.nextOffset + 1) % kOffsetWindow;
+
+    // Queueing only ever adds delay, so the fastest exchange gives the least biased offset
+    const OffsetSample& best = *std::min_element(state.offsets.begin(), state.offsets.end(),
+        [](const OffsetSample& a, const OffsetSample& b) { return a.delay < b.delay; });
+    state.stats.synced = true;
+    state.stats.offsetMicros = best.offset;
+    state.stats.offsetDelayMicros = best.delay;
+    ++state.stats.syncSamples;
+    return true;
+}
+
+void LatencyMonitor::onFanout(websocketpp::connection_hdl hdl, int64_t stampMicros, size_t backlogBytes) {
+    int64_t now = nowMicros();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(hdl);
+    if (it == m_connections.end()) {
+        return;
+    }
+    Stats& stats = it->second.stats;
+    stats.fanout.record(now - stampMicros);
+    stats.backlogBytes = backlogBytes;
+    stats.maxBacklogBytes = std::max(stats.maxBacklogBytes, backlogBytes);
+}
+
+void LatencyMonitor::onDelivery(websocketpp::connection_hdl hdl, int64_t serverStampMicros, int64_t clientReceiveMicros) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(hdl);
+    if (it == m_connections.end()) {
+        return;
+    }
+    Stats& stats = it->second.stats;
+    if (!stats.synced) {
+        ++stats.unsyncedReports;
+        return;
+    }
+    stats.delivery.record(clientReceiveMicros - stats.offsetMicros - serverStampMicros);
+}
+
+void LatencyMonitor::addConnection(websocketpp::connection_hdl hdl) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    connection(hdl);
+}
+
+std::vector<std::pair<websocketpp::connection_hdl, bool>> LatencyMonitor::probeTargets() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::pair<websocketpp::connection_hdl, bool>> targets;
+    targets.reserve(m_connections.size());
+    for (const auto& [hdl, state] : m_connections) {
+        targets.emplace_back(hdl, state.timeSync);
+    }
+    return targets;
+}
+
+void LatencyMonitor::removeConnection(websocketpp::connection_hdl hdl) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_connections.erase(hdl);
+}
+
+bool LatencyMonitor::stats(websocketpp::connection_hdl hdl, Stats& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_connections.find(hdl);
+    if (it == m_connections.end()) {
+        return false;
+    }
+    out = it->second.stats;
+    return true;
+}
+
+std::vector<LatencyMonitor::Stats> LatencyMonitor::allStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Stats> all;
+    all.reserve(m_connections.size());
+    for (const auto& [hdl, state] : m_connections) {
+        all.push_back(state.stats);
+    }
+    std::sort(all.begin(), all.end(), [](const Stats& a, const Stats& b) { return a.connectionId < b.connectionId; });
+    return all;
+}
+
+std::string LatencyMonitor::report(websocketpp::connection_hdl hdl) {
+    Stats snapshot;
+    if (!stats(hdl, snapshot)) {
+        return "";
+    }
+    return encode(snapshot);
+}
+
+std::string LatencyMonitor::encode(const Stats& stats) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+    auto writeHistogram = [&writer](const char* name, const LatencyHistogram& histogram) {
+        writer.Key(name);
+        writer.StartObject();
+        writer.Key("count");
+        writer.Uint64(histogram.count());
+        writer.Key("mean_us");
+        writer.Double(histogram.mean());
+        writer.Key("p50_us");
+        writer.Int64(histogram.percentile(0.50));
+        writer.Key("p90_us");
+        writer.Int64(histogram.percentile(0.90));
+        writer.Key("p99_us");
+        writer.Int64(histogram.percentile(0.99));
+        writer.Key("max_us");
+        writer.Int64(histogram.max());
+        writer.EndObject();
+    };
+
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("latency_stats");
+    writer.Key("connection_id");
+    writer.Uint64(stats.connectionId);
+    writeHistogram("rtt", stats.rtt);
+    writeHistogram("delivery", stats.delivery);
+    writeHistogram("fanout", stats.fanout);
+    writer.Key("synced");
+    writer.Bool(stats.synced);
+    writer.Key("offset_us");
+    writer.Int64(stats.offsetMicros);
+    writer.Key("offset_delay_us");
+    writer.Int64(stats.offsetDelayMicros);
+    writer.Key("sync_samples");
+    writer.Uint64(stats.syncSamples);
+    writer.Key("unsynced_reports");
+    writer.Uint64(stats.unsyncedReports);
+    writer.Key("lost_probes");
+    writer.Uint64(stats.lostProbes);
+    writer.Key("backlog_bytes");
+    writer.Uint64(stats.backlogBytes);
+    writer.Key("max_backlog_bytes");
+    writer.Uint64(stats.maxBacklogBytes);
+    writer.EndObject();
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+std::string LatencyMonitor::stampFrame(const std::string& frame, int64_t stampMicros) {
+    std::string stamped;
+    stampFrame(stamped, frame, stampMicros);
+    return stamped;
+}
+
+void LatencyMonitor::stampFrame(std::string& out, const std::string& frame, int64_t stampMicros) {
+    size_t open = frame.find('{');
+    if (open == std::string::npos) {
+        out.assign(frame);
+        return;
+    }
+    size_t next = frame.find_first_not_of(" \t\r\n", open + 1);
+    bool empty = next != std::string::npos && frame[next] == '}';
+
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), stampMicros).ptr;
+
+    out.clear();
+    out.reserve(frame.size() + 32);
+    out.append(frame, 0, open + 1);
+    out += "\"server_ts_us\":";
+    out.append(digits, end);
+    if (!empty) {
+        out += ',';
+    }
+    out.append(frame, open + 1, std::string::npos);
+}
@@ -0,0 +1,342 @@
+#include "loopback_exchange.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+using boost::asio::ip::tcp;
+
+namespace {
+    const char* kTokenPrefix = "loopback:";
+
+    std::string header(const std::string& headers, const char* name) {
+        size_t field = headers.find(name);
+        if (field == std::string::npos) {
+            return "";
+        }
+        size_t start = headers.find_first_not_of(' ', field + std::char_traits<char>::length(name));
+        return headers.substr(start, headers.find("\r\n", start) - start);
+    }
+
+    std::string stringParam(const rapidjson::Document& doc, const char* key) {
+        if (!doc.IsObject() || !doc.HasMember("params") || !doc["params"].IsObject()) {
+            return "";
+        }
+        const auto& params = doc["params"];
+        return params.HasMember(key) && params[key].IsString() ? params[key].GetString() : "";
+    }
+
+    double numberParam(const rapidjson::Document& doc, const char* key) {
+        if (!doc.IsObject() || !doc.HasMember("params") || !doc["params"].IsObject()) {
+            return 0.0;
+        }
+        const auto& params = doc["params"];
+        return params.HasMember(key) && params[key].IsNumber() ? params[key].GetDouble() : 0.0;
+    }
+
+    std::string result(const std::string& value) {
+        return R"({"jsonrpc":"2.0","id":1,"result":)" + value + "}";
+    }
+
+    std::string error(int code, const char* message) {
+        return R"({"jsonrpc":"2.0","id":1,"error":{"message":")" + std::string(message) + R"(","code":)" + std::to_string(code) + "}}";
+    }
+
+    // Same currency rule as the order manager: "BTC-PERPETUAL" and "BTC_USDC-PERPETUAL" are both BTC; "any" matches all
+    bool inCurrency(const std::string& instrument, const std::string& currency) {
+        if (currency.empty() || currency == "any" || (instrument.compare(0, currency.size(), currency) == 0 && instrument.size() > currency.size() &&
+                                 (instrument[currency.size()] == '-' || instrument[currency.size()] == '_'))) {
+            return true;
+        }
+        return instrument.find("_" + currency + "-") != std::string::npos;
+    }
+}
+
+// One keep-alive HTTP connection: reads a request, answers it, reads the next
+struct LoopbackExchange::Connection : std::enable_shared_from_this<Connection> {
+    Connection(tcp::socket socket, LoopbackExchange& exchange) : socket(std::move(socket)), exchange(exchange) {}
+
+    tcp::socket socket;
+    boost::asio::streambuf input;
+    std::string output;
+    LoopbackExchange& exchange;
+
+    void read() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(socket, input, "\r\n\r\n", [self](const boost::system::error_code& ec, size_t headerBytes) {
+            if (!ec) {
+                self->onHeaders(headerBytes);
+            }
+        });
+    }
+
+    void onHeaders(size_t headerBytes) {
+        auto begin = boost::asio::buffers_begin(input.data());
+        std::string headers(begin, begin + headerBytes);
+        input.consume(headerBytes);
+
+        size_t targetStart = headers.find(' ') + 1;
+        std::string target = headers.substr(targetStart, headers.find(' ', targetStart) - targetStart);
+        std::string authorization = header(headers, "Authorization:");
+        size_t length = std::strtoul(header(headers, "Content-Length:").c_str(), nullptr, 10);
+
+        if (input.size() >= length) {
+            respond(target, authorization, length);
+            return;
+        }
+        auto self = shared_from_this();
+        boost::asio::async_read(socket, input, boost::asio::transfer_exactly(length - input.size()),
+            [self, target, authorization, length](const boost::system::error_code& ec, size_t) {
+                if (!ec) {
+                    self->respond(target, authorization, length);
+                }
+            });
+    }
+
+    void respond(const std::string& target, const std::string& authorization, size_t length) {
+        auto begin = boost::asio::buffers_begin(input.data());
+        std::string body(begin, begin + length);
+        input.consume(length);
+
+        std::string reply = exchange.reply(target, authorization, body);
+        output = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(reply.size()) + "\r\n\r\n" + reply;
+        auto self = shared_from_this();
+        boost::asio::async_write(socket, boost::asio::buffer(output), [self](const boost::system::error_code& ec, size_t) {
+            if (!ec) {
+                self->read();
+            }
+        });
+    }
+};
+
+LoopbackExchange::LoopbackExchange(ThreadScope scope)
+    : m_acceptor(m_io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+    accept();
+    m_thread = std::thread([this, scope]() {
+        std::function<void()> serve = [this]() { m_io.run(); };
+        if (scope) {
+            scope(serve);
+        } else {
+            serve();
+        }
+    });
+}
+
+LoopbackExchange::~LoopbackExchange() {
+    m_io.stop();
+    m_thread.join();
+}
+
+std::string LoopbackExchange::url() const {
+    return "http://127.0.0.1:" + std::to_string(m_acceptor.local_endpoint().port()) + "/api/v2";
+}
+
+void LoopbackExchange::setCreditLimit(double maxCredits, double refillPerSecond) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_maxCredits = maxCredits;
+    m_refillPerSecond = refillPerSecond;
+    for (auto& [clientId, account] : m_accounts) {
+        account.initialized = false;
+    }
+}
+
+void LoopbackExchange::setPosition(const std::string& clientId, const std::string& instrument, double size, double averagePrice) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    account(clientId).positions[instrument] = {size, averagePrice};
+}
+
+std::string LoopbackExchange::addOrder(const std::string& clientId, const std::string& instrument, double amount, double price) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string orderId = "LB-" + std::to_string(m_nextOrderId++);
+    account(clientId).orders[orderId] = {instrument, "buy", amount, price};
+    return orderId;
+}
+
+std::string LoopbackExchange::ownerOf(const std::string& orderId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& [clientId, account] : m_accounts) {
+        if (account.orders.count(orderId)) {
+            return clientId;
+        }
+    }
+    return "";
+}
+
+size_t LoopbackExchange::openOrders(const std::string& clientId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return account(clientId).orders.size();
+}
+
+uint64_t LoopbackExchange::calls(const std::string& clientId, const std::string& method) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto& calls = account(clientId).calls;
+    auto it = calls.find(method);
+    return it != calls.end() ? it->second : 0;
+}
+
+uint64_t LoopbackExchange::rateLimited(const std::string& clientId) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return account(clientId).rateLimited;
+}
+
+void LoopbackExchange::accept() {
+    m_acceptor.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+        if (ec) {
+            return;
+        }
+        std::make_shared<Connection>(std::move(socket), *this)->read();
+        accept();
+    });
+}
+
+LoopbackExchange::Account& LoopbackExchange::account(const std::string& clientId) {
+    return m_accounts[clientId];
+}
+
+bool LoopbackExchange::takeCredit(Account& account) {
+    if (m_maxCredits <= 0.0) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!account.initialized) {
+        account.credits = m_maxCredits;
+        account.initialized = true;
+    } else {
+        double elapsed = std::chrono::duration<double>(now - account.updated).count();
+        account.credits = std::min(m_maxCredits, account.credits + elapsed * m_refillPerSecond);
+    }
+    account.updated = now;
+    if (account.credits < 1.0) {
+        return false;
+    }
+    account.credits -= 1.0;
+    return true;
+}
+
+std::string LoopbackExchange::reply(const std::string& target, const std::string& authorization, const std::string& body) {
+    size_t methodStart = target.find("/public/");
+    if (methodStart == std::string::npos) {
+        methodStart = target.find("/private/");
+    }
+    std::string method = methodStart == std::string::npos ? "" : target.substr(methodStart + 1, target.find('?') - methodStart - 1);
+
+    rapidjson::Document doc;
+    doc.Parse(body.c_str());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (method == "public/auth") {
+        std::string clientId = stringParam(doc, "client_id");
+        account(clientId);
+        return result(R"({"access_token":")" + std::string(kTokenPrefix) + clientId + R"(","expires_in":86400})");
+    }
+    if (method == "public/get_order_book") {
+        return result(R"({"instrument_name":"BTC-PERPETUAL","change_id":)" + std::to_string(m_changeId++) +
+                      R"(,"timestamp":1700000000000,"bids":[[50000.0,10.0],[49999.5,4.0]],"asks":[[50000.5,8.0],[50001.0,3.0]]})");
+    }
+    if (method.compare(0, 8, "private/") != 0) {
+        return result(R"("ok")");
+    }
+
+    size_t token = authorization.find(kTokenPrefix);
+    if (token == std::string::npos) {
+        return error(13009, "unauthorized");
+    }
+    Account& caller = account(authorization.substr(token + std::char_traits<char>::length(kTokenPrefix)));
+    ++caller.calls[method];
+    if (!takeCredit(caller)) {
+        ++caller.rateLimited;
+        return error(10028, "too_many_requests");
+    }
+
+    if (method == "private/buy" || method == "private/sell") {
+        Order order{stringParam(doc, "instrument_name"), method.substr(8), numberParam(doc, "amount"), numberParam(doc, "price")};
+        std::string orderId = "LB-" + std::to_string(m_nextOrderId++);
+        caller.orders[orderId] = order;
+        return result(R"({"order":)" + orderJson(orderId, order, "open") + R"(,"trades":[]})");
+    }
+    if (method == "private/cancel" || method == "private/edit") {
+        auto it = caller.orders.find(stringParam(doc, "order_id"));
+        if (it == caller.orders.end()) {
+            return error(10004, "order_not_found");
+        }
+        if (method == "private/cancel") {
+            std::string reply = result(orderJson(it->first, it->second, "cancelled"));
+            caller.orders.erase(it);
+            return reply;
+        }
+        it->second.amount = numberParam(doc, "amount");
+        it->second.price = numberParam(doc, "price");
+        return result(R"({"order":)" + orderJson(it->first, it->second, "open") + R"(,"trades":[]})");
+    }
+    if (method.compare(0, 18, "private/cancel_all") == 0) {
+        std::string currency = stringParam(doc, "currency");
+        std::string instrument = stringParam(doc, "instrument_name");
+        size_t cancelled = 0;
+        for (auto it = caller.orders.begin(); it != caller.orders.end();) {
+            if (inCurrency(it->second.instrument, currency) && (instrument.empty() || it->second.instrument == instrument)) {
+                it = caller.orders.erase(it);
+                ++cancelled;
+            } else {
+                ++it;
+            }
+        }
+        return result(std::to_string(cancelled));
+    }
+    if (method.compare(0, 23, "private/get_open_orders") == 0) {
+        std::string currency = stringParam(doc, "currency");
+        std::string instrument = stringParam(doc, "instrument_name");
+        std::string orders = "[";
+        for (const auto& [orderId, order] : caller.orders) {
+            if (inCurrency(order.instrument, currency) && (instrument.empty() || order.instrument == instrument)) {
+                orders += (orders.size() > 1 ? "," : "") + orderJson(orderId, order, "open");
+            }
+        }
+        return result(orders + "]");
+    }
+    if (method == "private/get_positions") {
+        std::string currency = stringParam(doc, "currency");
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartArray();
+        for (const auto& [instrument, position] : caller.positions) {
+            if (!inCurrency(instrument, currency)) {
+                continue;
+            }
+            writer.StartObject();
+            writer.Key("instrument_name");
+            writer.String(instrument.c_str());
+            writer.Key("size");
+            writer.Double(position.size);
+            writer.Key("average_price");
+            writer.Double(position.averagePrice);
+            writer.Key("direction");
+            writer.String(position.size > 0 ? "buy" : position.size < 0 ? "sell" : "zero");
+            writer.EndObject();
+        }
+        writer.EndArray();
+        return result(buffer.GetString());
+    }
+    return result(R"("ok")");
+}
+
+std::string LoopbackExchange::orderJson(const std::string& orderId, const Order& order, const char* state) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("order_id");
+    writer.String(orderId.c_str());
+    writer.Key("instrument_name");
+    writer.String(order.instrument.c_str());
+    writer.Key("direction");
+    writer.String(order.direction.c_str());
+    writer.Key("price");
+    writer.Double(order.price);
+    writer.Key("amount");
+    writer.Double(order.amount);
+    writer.Key("order_state");
+    writer.String(state);
+    writer.EndObject();
+    return buffer.GetString();
+}
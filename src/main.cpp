@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <future>
 #include <iomanip>
 #include <string>
 #include <limits>
@@ -10,16 +13,41 @@
 #include <rapidjson/prettywriter.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/error/en.h>
+#include "allocation_check.hpp"
+#include "memory_pool.hpp"
 #include "utils.hpp"
 #include "order_manager.hpp"
+#include "state_snapshot.hpp"
 #include "websocket_handler.hpp"
 
-void websocketServerControl(WebSocketHandler& wsHandler, std::atomic<bool>& isRunning, std::atomic<bool>& isBroadcasting) {
+void printKillSwitchReport(const OrderManager::KillSwitchReport& report) {
+    if (!report.ok) {
+        std::cout << "Kill switch failed: " << report.error << std::endl;
+        return;
+    }
+    std::cout << "Kill switch cancelled " << report.cancelled << " orders.\n";
+    std::cout << "Trigger to cancel acknowledged: " << report.ackMicros << " us\n";
+    if (report.flat) {
+        std::cout << "Trigger to confirmed flat: " << report.flatMicros << " us\n";
+    } else {
+        std::cout << "Could not confirm the account is flat: " << report.error << "\n";
+    }
+    UtilityNamespace::logMessage("Kill switch executed");
+}
+
+void websocketServerControl(WebSocketHandler& wsHandler, OrderManager& orderManager, std::atomic<bool>& isRunning, std::atomic<bool>& isBroadcasting) {
     std::cout << "\nWebSocket Server Control Commands:\n";
     std::cout << " - start <port>: Start the WebSocket server on the specified port\n";
     std::cout << " - stop: Stop the WebSocket server\n";
     std::cout << " - broadcast: Start broadcasting order book updates\n";
     std::cout << " - stop_broadcast: Stop broadcasting updates\n";
+    std::cout << " - gateway <token>: Accept orders from clients that authenticate with <token>\n";
+    std::cout << " - gateway_off: Stop accepting orders from clients\n";
+    std::cout << " - ratelimit: Show outbound queue depth and credit utilization per account\n";
+    std::cout << " - route <instrument|strategy|least_loaded>: Choose how new orders are spread over accounts\n";
+    std::cout << " - latency: Show time to first valid quote and per-connection RTT, clock offset, fan-out and delivery latency\n";
+    std::cout << " - kill: Kill switch - cancel every open order and confirm the account is flat\n";
+    std::cout << " - rearm: Accept new orders again after the kill switch\n";
     std::cout << " - back: Return to the main menu\n";
 
     std::string command;
@@ -64,6 +92,70 @@ void websocketServerControl(WebSocketHandler& wsHandler, std::atomic<bool>& isRu
                 isBroadcasting = false;
                 std::cout << "Broadcasting has stopped.\n";
             }
+        } else if (command == "gateway") {
+            std::string token;
+            std::cin >> token;
+            wsHandler.enableOrderGateway(orderManager, token);
+            std::cout << "Order gateway enabled.\n";
+        } else if (command == "gateway_off") {
+            wsHandler.disableOrderGateway();
+            std::cout << "Order gateway disabled.\n";
+        } else if (command == "ratelimit") {
+            for (size_t i = 0; i < orderManager.sessionCount(); ++i) {
+                RateLimitScheduler::Stats stats = orderManager.session(i).schedulerStats();
+                std::cout << "Account " << i << " - queued (cancel/modify/new/market data): " << stats.queued[RateLimitScheduler::Cancel] << "/"
+                          << stats.queued[RateLimitScheduler::Modify] << "/" << stats.queued[RateLimitScheduler::New] << "/"
+                          << stats.queued[RateLimitScheduler::MarketData] << "\n";
+                std::cout << "Sent: " << stats.sent << ", merged: " << stats.merged << ", dropped: " << stats.dropped
+                          << ", throttled by exchange: " << stats.rateLimited << "\n";
+                std::cout << std::fixed << std::setprecision(1)
+                          << "Credit utilization (matching/non-matching): " << stats.matchingUtilization * 100 << "% / "
+                          << stats.nonMatchingUtilization * 100 << "%\n";
+                std::cout.unsetf(std::ios::fixed);
+            }
+            OrderManager::AmendStats amends = orderManager.amendStats();
+            std::cout << "Edits requested: " << amends.requested << ", sent: " << amends.sent
+                      << ", coalesced: " << amends.coalesced << ", dropped by cancel: " << amends.dropped << "\n";
+        } else if (command == "route") {
+            std::string policy;
+            std::cin >> policy;
+            if (policy == "instrument") {
+                orderManager.setRoutingPolicy(OrderManager::RoutingPolicy::ByInstrument);
+            } else if (policy == "strategy") {
+                orderManager.setRoutingPolicy(OrderManager::RoutingPolicy::ByStrategyTag);
+            } else if (policy == "least_loaded") {
+                orderManager.setRoutingPolicy(OrderManager::RoutingPolicy::LeastLoaded);
+            } else {
+                std::cout << "Unknown routing policy.\n";
+                continue;
+            }
+            std::cout << "Routing new orders by " << policy << " across " << orderManager.sessionCount() << " account(s).\n";
+        } else if (command == "latency") {
+            int64_t firstQuote = wsHandler.firstValidQuoteMicros();
+            if (firstQuote >= 0) {
+                std::cout << "Time to first valid quote since start: " << firstQuote / 1000 << " ms\n";
+            }
+            std::vector<LatencyMonitor::Stats> connections = wsHandler.latencyStats();
+            if (connections.empty()) {
+                std::cout << "No connected clients.\n";
+            }
+            for (const auto& stats : connections) {
+                std::cout << "Connection " << stats.connectionId << ": rtt p50/p99 " << stats.rtt.percentile(0.5) << "/"
+                          << stats.rtt.percentile(0.99) << "us (" << stats.rtt.count() << " probes, " << stats.lostProbes << " lost)";
+                if (stats.synced) {
+                    std::cout << ", offset " << stats.offsetMicros << "us +/- " << stats.offsetDelayMicros / 2 << "us";
+                }
+                std::cout << "\n  fan-out p50/p99 " << stats.fanout.percentile(0.5) << "/" << stats.fanout.percentile(0.99)
+                          << "us, backlog " << stats.backlogBytes << "B (max " << stats.maxBacklogBytes << "B)"
+                          << ", delivery p50/p99 " << stats.delivery.percentile(0.5) << "/" << stats.delivery.percentile(0.99)
+                          << "us (" << stats.delivery.count() << " reports)\n";
+            }
+        } else if (command == "kill") {
+            OrderManager::KillSwitchReport report = orderManager.killSwitch();
+            printKillSwitchReport(report);
+        } else if (command == "rearm") {
+            orderManager.rearm();
+            std::cout << "Kill switch re-armed; new orders are accepted again.\n";
         } else if (command == "back") {
             break; 
         } else {
@@ -177,6 +269,36 @@ void cancelOrder(OrderManager& orderManager) {
     prettyPrintJSON(cancelResponse);
 }
 
+void massCancel(OrderManager& orderManager) {
+    std::string scope;
+    std::cout << "Enter scope (all/currency/instrument): ";
+    std::cin >> scope;
+
+    std::string response;
+    if (scope == "currency") {
+        std::string currency;
+        std::cout << "Enter currency (e.g., BTC): ";
+        std::cin >> currency;
+        response = orderManager.cancelAllByCurrency(currency);
+    } else if (scope == "instrument") {
+        std::string instrumentName;
+        std::cout << "Enter instrument name: ";
+        std::cin >> instrumentName;
+        response = orderManager.cancelAllByInstrument(instrumentName);
+    } else if (scope == "all") {
+        auto start = std::chrono::high_resolution_clock::now();
+        response = orderManager.cancelAll();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Mass Cancel Latency: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us\n";
+    } else {
+        std::cout << "Invalid scope.\n";
+        return;
+    }
+    UtilityNamespace::logMessage("Mass cancel sent");
+    std::cout << "Mass Cancel Response: " << std::endl;
+    prettyPrintJSON(response);
+}
+
 void fetchCurrentPositions(OrderManager& orderManager) {
     std::string currency;
     std::cout << "Enter currency to fetch positions (e.g., BTC): ";
@@ -341,21 +463,70 @@ void printInstruments(OrderManager& orderManager) {
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Before anything initializes curl with the default allocator
+    CurlMemory::install();
+    if (argc > 1 && std::string(argv[1]) == "--alloc-check") {
+        return AllocationCheck::run();
+    }
+
+    auto bootTime = std::chrono::steady_clock::now();
     std::cout << "Program Started!" << std::endl;
     try {
-        std::cout << "Authenticating..." << std::endl;
-        std::string accessToken = UtilityNamespace::authenticate();
-        if (accessToken.empty()) {
-            throw std::runtime_error("Authentication failed. Access token is empty.");
+        const char* snapshotEnv = std::getenv("OEMS_SNAPSHOT_PATH");
+        std::string snapshotPath = snapshotEnv ? snapshotEnv : "oems_state.snap";
+        StateSnapshot::State restored;
+        bool warm = StateSnapshot::load(snapshotPath, restored);
+
+        auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        // A token that has not expired yet shows the credentials worked moments ago
+        bool recentlyAuthenticated = warm && std::any_of(restored.tokenExpiries.begin(), restored.tokenExpiries.end(),
+                                                         [nowMs](const StateSnapshot::TokenExpiry& token) { return token.expiresAtMs > nowMs; });
+        if (warm) {
+            std::cout << "Warm start from " << snapshotPath << " (" << (nowMs - restored.writtenAtMs) / 1000 << "s old): " << restored.instruments.size()
+                      << " instruments, " << restored.books.size() << " books, " << restored.orders.size() << " open orders.\n";
+        }
+        if (!recentlyAuthenticated) {
+            // Cold start, or the snapshot's tokens have lapsed: check the credentials before anything else depends on them
+            std::cout << "Authenticating..." << std::endl;
+            std::string accessToken = UtilityNamespace::authenticate();
+            if (accessToken.empty()) {
+                throw std::runtime_error("Authentication failed. Access token is empty.");
+            }
+            UtilityNamespace::logMessage("Successfully authenticated. Access token acquired.");
         }
-        UtilityNamespace::logMessage("Successfully authenticated. Access token acquired.");
 
-        OrderManager orderManager;
+        OrderManager orderManager(warm ? &restored : nullptr);
         WebSocketHandler wsHandler;
+        wsHandler.restoreState(warm ? &restored : nullptr, bootTime);
         std::atomic<bool> isRunning(false);
         std::atomic<bool> isBroadcasting(false);
 
+        StateSnapshot snapshotWriter(snapshotPath, std::chrono::seconds(5));
+        snapshotWriter.start([&orderManager, &wsHandler](StateSnapshot::State& state) {
+            orderManager.exportState(state);
+            wsHandler.exportState(state);
+        });
+
+        // Reconcile in the background so the menu is usable at once; the future joins on exit
+        std::future<void> reconciliation;
+        if (warm) {
+            reconciliation = std::async(std::launch::async, [&orderManager, &wsHandler]() {
+                WebSocketHandler::WarmStartReport books = wsHandler.reconcileState();
+                OrderManager::ReconcileReport orders = orderManager.reconcile();
+                std::cout << "\nWarm start reconciled: books " << books.booksUnchanged << " unchanged / " << books.booksUpdated
+                          << " updated / " << books.booksFailed << " failed; time to first valid quote "
+                          << books.firstValidQuoteMicros / 1000 << " ms.\n";
+                if (orders.ok) {
+                    std::cout << "Orders " << orders.ordersKept << " kept / " << orders.ordersChanged << " changed / "
+                              << orders.ordersAdded << " new / " << orders.ordersRemoved << " gone; "
+                              << orders.positionsChanged << " positions changed (" << orders.micros / 1000 << " ms).\n";
+                } else {
+                    std::cout << orders.error << "\n";
+                }
+            });
+        }
+
         while (true) {
             std::cout << "\nChoose an action:\n";
             std::cout << "1. Place Order\n";
@@ -365,7 +536,8 @@ int main() {
             std::cout << "5. Fetch Order Book\n";
             std::cout << "6. Get instruments\n";
             std::cout << "7. WebSocket Server Control\n";
-            std::cout << "8. Exit\n";
+            std::cout << "8. Mass Cancel\n";
+            std::cout << "9. Exit\n";
             std::cout << "Enter your choice: ";
 
             int choice;
@@ -374,7 +546,7 @@ int main() {
             if (std::cin.fail()) {
                 std::cin.clear();
                 std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-                std::cout << "Invalid input. Please enter a number between 1 and 8.\n";
+                std::cout << "Invalid input. Please enter a number between 1 and 9.\n";
                 continue;
             }
             // ignore the input buffer until the newline character
@@ -400,9 +572,12 @@ int main() {
                     printInstruments(orderManager);
                     break;
                 case 7:
-                    websocketServerControl(wsHandler, isRunning, isBroadcasting);
+                    websocketServerControl(wsHandler, orderManager, isRunning, isBroadcasting);
                     break;
                 case 8:
+                    massCancel(orderManager);
+                    break;
+                case 9:
                     if (isRunning) {
                         wsHandler.stopServer();
                     }
@@ -412,7 +587,7 @@ int main() {
                     std::cout << "Exiting program." << std::endl;
                     return 0;
                 default:
-                    std::cout << "Invalid choice. Please enter a number between 1 and 8.\n";
+                    std::cout << "Invalid choice. Please enter a number between 1 and 9.\n";
                     break;
             }
         }
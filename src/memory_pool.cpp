@@ -0,0 +1,147 @@
+#include "memory_pool.hpp"
+#include <curl/curl.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+namespace {
+    // Classes from 32 bytes to 256 KiB; larger blocks bypass the free lists
+    constexpr size_t kMinClassShift = 5;
+    constexpr size_t kClassCount = 14;
+    constexpr size_t kUnpooled = kClassCount;
+    // Beyond this many idle blocks a class returns frees to the heap
+    constexpr size_t kMaxIdleBlocks = 256;
+
+    // Precedes every block handed to curl; a free block keeps its next link in the payload
+    struct alignas(std::max_align_t) BlockHeader {
+        size_t sizeClass;
+        size_t bytes; // usable bytes
+    };
+
+    struct FreeList {
+        std::mutex mutex;
+        BlockHeader* head = nullptr;
+        size_t idle = 0;
+    };
+
+    FreeList g_freeLists[kClassCount];
+
+    BlockHeader*& nextFree(BlockHeader* block) {
+        return *reinterpret_cast<BlockHeader**>(block + 1);
+    }
+
+    void* curlMalloc(size_t size) {
+        size_t sizeClass = 0;
+        while (sizeClass < kClassCount && (size_t(1) << (sizeClass + kMinClassShift)) < size) {
+            ++sizeClass;
+        }
+        if (sizeClass < kClassCount) {
+            FreeList& list = g_freeLists[sizeClass];
+            std::lock_guard<std::mutex> lock(list.mutex);
+            if (BlockHeader* block = list.head) {
+                list.head = nextFree(block);
+                --list.idle;
+                return block + 1;
+            }
+        }
+        size_t bytes = sizeClass < kClassCount ? size_t(1) << (sizeClass + kMinClassShift) : size;
+        auto* block = static_cast<BlockHeader*>(::operator new(sizeof(BlockHeader) + bytes, std::nothrow));
+        if (!block) {
+            return nullptr;
+        }
+        block->sizeClass = sizeClass;
+        block->bytes = bytes;
+        return block + 1;
+    }
+
+    void curlFree(void* ptr) {
+        if (!ptr) {
+            return;
+        }
+        BlockHeader* block = static_cast<BlockHeader*>(ptr) - 1;
+        if (block->sizeClass != kUnpooled) {
+            FreeList& list = g_freeLists[block->sizeClass];
+            std::lock_guard<std::mutex> lock(list.mutex);
+            if (list.idle < kMaxIdleBlocks) {
+                nextFree(block) = list.head;
+                list.head = block;
+                ++list.idle;
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+    void* curlRealloc(void* ptr, size_t size) {
+        if (!ptr) {
+            return curlMalloc(size);
+        }
+        BlockHeader* block = static_cast<BlockHeader*>(ptr) - 1;
+        if (size <= block->bytes) {
+            return ptr;
+        }
+        void* resized = curlMalloc(size);
+        if (resized) {
+            std::memcpy(resized, ptr, block->bytes);
+            curlFree(ptr);
+        }
+        return resized;
+    }
+
+    char* curlStrdup(const char* str) {
+        size_t size = std::strlen(str) + 1;
+        void* copy = curlMalloc(size);
+        return copy ? static_cast<char*>(std::memcpy(copy, str, size)) : nullptr;
+    }
+
+    void* curlCalloc(size_t items, size_t size) {
+        void* block = curlMalloc(items * size);
+        return block ? std::memset(block, 0, items * size) : nullptr;
+    }
+}
+
+void* HeapAllocator::Malloc(size_t size) {
+    return size ? ::operator new(size) : nullptr;
+}
+
+void* HeapAllocator::Realloc(void* original, size_t originalSize, size_t newSize) {
+    if (newSize == 0) {
+        Free(original);
+        return nullptr;
+    }
+    void* resized = ::operator new(newSize);
+    if (original) {
+        std::memcpy(resized, original, std::min(originalSize, newSize));
+        Free(original);
+    }
+    return resized;
+}
+
+void HeapAllocator::Free(void* ptr) {
+    ::operator delete(ptr);
+}
+
+JsonArena::JsonArena()
+    : m_buffer(new char[kValueBytes + kStackBytes]),
+      m_values(m_buffer.get(), kValueBytes, kValueBytes, &m_base),
+      m_stack(m_buffer.get() + kValueBytes, kStackBytes, kStackBytes, &m_base),
+      m_document(&m_values, kStackBytes / 2, &m_stack) {}
+
+JsonArena& JsonArena::local() {
+    thread_local JsonArena arena;
+    return arena;
+}
+
+JsonArena::Document& JsonArena::parse(const std::string& json) {
+    // The parse stack is released after every parse, so both pools can be rewound;
+    // anything that outgrew the buffer goes back to the heap here
+    m_values.Clear();
+    m_stack.Clear();
+    m_document.Parse(json.c_str(), json.size());
+    return m_document;
+}
+
+bool CurlMemory::install() {
+    return curl_global_init_mem(CURL_GLOBAL_DEFAULT, curlMalloc, curlFree, curlRealloc, curlStrdup, curlCalloc) == CURLE_OK;
+}
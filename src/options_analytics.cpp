@@ -0,0 +1,345 @@
+#include "options_analytics.hpp"
+#include "options_pricing.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <thread>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+namespace {
+
+    constexpr double kMillisPerYear = 365.25 * 24 * 3600 * 1000;
+
+    std::string currencyOf(const std::string& instrumentName) {
+        return instrumentName.substr(0, instrumentName.find('-'));
+    }
+
+    // Options are named <CURRENCY>-<EXPIRY>-<STRIKE>-<C|P>; perpetuals and futures share the currency
+    bool isOptionName(const std::string& instrumentName) {
+        size_t n = instrumentName.size();
+        return n > 2 && instrumentName[n - 2] == '-' && (instrumentName[n - 1] == 'C' || instrumentName[n - 1] == 'P') &&
+               std::count(instrumentName.begin(), instrumentName.end(), '-') == 3;
+    }
+
+    double numberOr(const rapidjson::Value& object, const char* key, double fallback) {
+        return (object.HasMember(key) && object[key].IsNumber()) ? object[key].GetDouble() : fallback;
+    }
+
+    int64_t wallClockMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void writeNumber(rapidjson::Writer<rapidjson::StringBuffer>& writer, double value) {
+        // JSON has no NaN; unsolvable quotes are sent as null
+        if (std::isfinite(value)) {
+            writer.Double(value);
+        } else {
+            writer.Null();
+        }
+    }
+}
+
+size_t OptionsAnalytics::loadChain(const std::string& currency, const std::string& instrumentsJson) {
+    rapidjson::Document doc;
+    doc.Parse(instrumentsJson.c_str());
+    if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+        return 0;
+    }
+
+    int64_t nowMs = wallClockMs();
+    std::map<int64_t, Expiry> byExpiry;
+    for (const auto& instrument : doc["result"].GetArray()) {
+        if (!instrument.IsObject() || !instrument.HasMember("kind") || std::string(instrument["kind"].GetString()) != "option" ||
+            !instrument.HasMember("instrument_name") || !instrument.HasMember("strike") ||
+            !instrument.HasMember("expiration_timestamp") || !instrument.HasMember("option_type") ||
+            instrument["expiration_timestamp"].GetInt64() <= nowMs) {
+            continue;
+        }
+        Expiry& expiry = byExpiry[instrument["expiration_timestamp"].GetInt64()];
+        expiry.names.push_back(instrument["instrument_name"].GetString());
+        expiry.strike.push_back(instrument["strike"].GetDouble());
+        expiry.sign.push_back(std::string(instrument["option_type"].GetString()) == "call" ? 1.0 : -1.0);
+    }
+
+    Chain chain;
+    chain.loadedMs = nowMs;
+    chain.firstExpiryMs = byExpiry.empty() ? 0 : byExpiry.begin()->first;
+    size_t count = 0;
+    for (auto& [expirationMs, expiry] : byExpiry) {
+        size_t n = expiry.names.size();
+        expiry.expirationMs = expirationMs;
+        expiry.mid.assign(n, std::numeric_limits<double>::quiet_NaN());
+        expiry.premium.assign(n, 0.0);
+        for (auto* column : {&expiry.iv, &expiry.delta, &expiry.gamma, &expiry.vega, &expiry.theta}) {
+            column->assign(n, std::numeric_limits<double>::quiet_NaN());
+        }
+
+        uint32_t expiryIndex = static_cast<uint32_t>(chain.expiries.size());
+        for (uint32_t row = 0; row < n; ++row) {
+            chain.index.emplace(expiry.names[row], std::make_pair(expiryIndex, row));
+        }
+        count += n;
+        chain.expiries.push_back(std::move(expiry));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_chains[currency] = std::move(chain);
+    return count;
+}
+
+OptionsAnalytics::~OptionsAnalytics() {
+    {
+        std::lock_guard<std::mutex> lock(m_workMutex);
+        m_stopping = true;
+    }
+    m_workReady.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+bool OptionsAnalytics::hasChain(const std::string& currency) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_chains.count(currency) > 0;
+}
+
+bool OptionsAnalytics::reloadDue(const std::string& currency) {
+    int64_t nowMs = wallClockMs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_chains.find(currency);
+    bool due = it == m_chains.end() || it->second.unlisted || nowMs - it->second.loadedMs >= kReloadIntervalMs ||
+               (it->second.firstExpiryMs != 0 && nowMs >= it->second.firstExpiryMs);
+    int64_t& attemptMs = m_reloadAttemptMs[currency];
+    if (!due || nowMs - attemptMs < kReloadRetryMs) {
+        return false;
+    }
+    attemptMs = nowMs;
+    return true;
+}
+
+bool OptionsAnalytics::updateQuote(const std::string& instrumentName, double bid, double ask, double underlyingPrice) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return updateQuoteLocked(instrumentName, bid, ask, underlyingPrice);
+}
+
+bool OptionsAnalytics::updateQuoteLocked(const std::string& instrumentName, double bid, double ask, double underlyingPrice) {
+    auto chainIt = m_chains.find(currencyOf(instrumentName));
+    if (chainIt == m_chains.end()) {
+        return false;
+    }
+    Chain& chain = chainIt->second;
+    auto it = chain.index.find(instrumentName);
+    if (it == chain.index.end()) {
+        // An option listed after the chain was loaded
+        if (isOptionName(instrumentName)) {
+            chain.unlisted = true;
+        }
+        return false;
+    }
+
+    Expiry& expiry = chain.expiries[it->second.first];
+    uint32_t row = it->second.second;
+    double mid = (bid > 0.0 && ask > 0.0) ? 0.5 * (bid + ask) : std::numeric_limits<double>::quiet_NaN();
+    double forward = underlyingPrice > 0.0 ? underlyingPrice : expiry.forward;
+
+    bool sameMid = mid == expiry.mid[row] || (std::isnan(mid) && std::isnan(expiry.mid[row]));
+    if (sameMid && forward == expiry.forward) {
+        return true;
+    }
+    expiry.mid[row] = mid;
+    expiry.forward = forward;
+    expiry.dirty = true;
+    chain.frameStale = true;
+    return true;
+}
+
+size_t OptionsAnalytics::applyBookSummary(const std::string& currency, const std::string& summaryJson) {
+    rapidjson::Document doc;
+    doc.Parse(summaryJson.c_str());
+    if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+        return 0;
+    }
+
+    size_t updated = 0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_chains.count(currency) == 0) {
+        return 0;
+    }
+    for (const auto& summary : doc["result"].GetArray()) {
+        if (!summary.IsObject() || !summary.HasMember("instrument_name")) {
+            continue;
+        }
+        if (updateQuoteLocked(summary["instrument_name"].GetString(), numberOr(summary, "bid_price", 0.0),
+                              numberOr(summary, "ask_price", 0.0), numberOr(summary, "underlying_price", 0.0))) {
+            ++updated;
+        }
+    }
+    return updated;
+}
+
+bool OptionsAnalytics::applyOrderBook(const std::string& orderBookJson) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_chains.empty()) {
+            return false;
+        }
+    }
+
+    rapidjson::Document doc;
+    doc.Parse(orderBookJson.c_str());
+    if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsObject() ||
+        !doc["result"].HasMember("instrument_name")) {
+        return false;
+    }
+    const auto& book = doc["result"];
+    return updateQuote(book["instrument_name"].GetString(), numberOr(book, "best_bid_price", 0.0),
+                       numberOr(book, "best_ask_price", 0.0), numberOr(book, "underlying_price", 0.0));
+}
+
+std::string OptionsAnalytics::snapshot(const std::string& currency) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_chains.find(currency);
+    if (it == m_chains.end()) {
+        return "";
+    }
+    Chain& chain = it->second;
+    if (chain.frameStale) {
+        recompute(chain);
+        encode(currency, chain);
+        chain.frameStale = false;
+    }
+    return chain.frame;
+}
+
+int64_t OptionsAnalytics::lastComputeMicros(const std::string& currency) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_chains.find(currency);
+    return it == m_chains.end() ? 0 : it->second.computeMicros;
+}
+
+// Expiries are independent, so dirty ones are spread across the solver pool
+void OptionsAnalytics::recompute(Chain& chain) {
+    auto start = std::chrono::steady_clock::now();
+    int64_t nowMs = wallClockMs();
+
+    std::vector<Expiry*> dirty;
+    for (auto& expiry : chain.expiries) {
+        if (expiry.dirty) {
+            dirty.push_back(&expiry);
+        }
+    }
+
+    if (dirty.size() <= 1 || std::thread::hardware_concurrency() <= 1) {
+        for (Expiry* expiry : dirty) {
+            solveExpiry(*expiry, nowMs);
+        }
+    } else {
+        if (m_workers.empty()) {
+            for (unsigned i = 1; i < std::thread::hardware_concurrency(); ++i) {
+                m_workers.emplace_back([this]() { workerLoop(); });
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_workMutex);
+            m_work.swap(dirty);
+            m_workNowMs = nowMs;
+            m_nextWork = 0;
+            m_busyWorkers = m_workers.size();
+            ++m_workGeneration;
+        }
+        m_workReady.notify_all();
+        solvePending();
+        std::unique_lock<std::mutex> lock(m_workMutex);
+        m_workDone.wait(lock, [this]() { return m_busyWorkers == 0; });
+        m_work.clear();
+    }
+
+    chain.computeMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void OptionsAnalytics::workerLoop() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_workMutex);
+            m_workReady.wait(lock, [this, seen]() { return m_stopping || m_workGeneration != seen; });
+            if (m_stopping) {
+                return;
+            }
+            seen = m_workGeneration;
+        }
+        solvePending();
+        std::lock_guard<std::mutex> lock(m_workMutex);
+        if (--m_busyWorkers == 0) {
+            m_workDone.notify_one();
+        }
+    }
+}
+
+// Each thread claims the next unsolved expiry until none are left
+void OptionsAnalytics::solvePending() {
+    for (size_t i = m_nextWork++; i < m_work.size(); i = m_nextWork++) {
+        solveExpiry(*m_work[i], m_workNowMs);
+    }
+}
+
+void OptionsAnalytics::solveExpiry(Expiry& expiry, int64_t nowMs) {
+    size_t n = expiry.names.size();
+    double t = (expiry.expirationMs - nowMs) / kMillisPerYear;
+    for (size_t i = 0; i < n; ++i) {
+        expiry.premium[i] = expiry.mid[i] * expiry.forward;
+    }
+
+    OptionsPricing::impliedVolBatch(expiry.forward, t, expiry.strike.data(), expiry.sign.data(),
+                                    expiry.premium.data(), expiry.iv.data(), n);
+    OptionsPricing::greeksBatch(expiry.forward, t, expiry.strike.data(), expiry.sign.data(), expiry.iv.data(),
+                                expiry.delta.data(), expiry.gamma.data(), expiry.vega.data(), expiry.theta.data(), n);
+    expiry.dirty = false;
+}
+
+void OptionsAnalytics::encode(const std::string& currency, Chain& chain) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("greeks");
+    writer.Key("currency");
+    writer.String(currency.c_str());
+    writer.Key("compute_us");
+    writer.Int64(chain.computeMicros);
+    writer.Key("options");
+    writer.StartArray();
+    for (const auto& expiry : chain.expiries) {
+        for (size_t i = 0; i < expiry.names.size(); ++i) {
+            writer.StartObject();
+            writer.Key("instrument_name");
+            writer.String(expiry.names[i].c_str());
+            writer.Key("expiration_timestamp");
+            writer.Int64(expiry.expirationMs);
+            writer.Key("strike");
+            writer.Double(expiry.strike[i]);
+            writer.Key("forward");
+            writeNumber(writer, expiry.forward);
+            writer.Key("mid");
+            writeNumber(writer, expiry.mid[i]);
+            writer.Key("iv");
+            writeNumber(writer, expiry.iv[i]);
+            writer.Key("delta");
+            writeNumber(writer, expiry.delta[i]);
+            writer.Key("gamma");
+            writeNumber(writer, expiry.gamma[i]);
+            writer.Key("vega");
+            writeNumber(writer, expiry.vega[i]);
+            writer.Key("theta");
+            writeNumber(writer, expiry.theta[i]);
+            writer.EndObject();
+        }
+    }
+    writer.EndArray();
+    writer.EndObject();
+    chain.frame.assign(buffer.GetString(), buffer.GetSize());
+}
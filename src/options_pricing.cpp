@@ -0,0 +1,138 @@
+#include "options_pricing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+    constexpr double kInvSqrt2 = 0.70710678118654752440;
+    constexpr double kInvSqrt2Pi = 0.39894228040143267794;
+    constexpr double kSqrt2Pi = 2.50662827463100050242;
+
+    // Lanes solved together; sized so the per-block state stays on the stack
+    constexpr size_t kBlock = 64;
+    constexpr int kMaxIterations = 40;
+    constexpr double kPriceTolerance = 1e-10;
+    constexpr double kMinVol = 1e-4;
+    constexpr double kMaxVol = 10.0;
+
+    inline double normCdf(double x) {
+        return 0.5 * std::erfc(-x * kInvSqrt2);
+    }
+
+    inline double normPdf(double x) {
+        return kInvSqrt2Pi * std::exp(-0.5 * x * x);
+    }
+
+    // By exponent bits, so it still holds when the file is built with fast-math
+    inline bool isFinite(double x) {
+        uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return (bits & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL;
+    }
+}
+
+namespace OptionsPricing {
+
+    double black76Price(double forward, double strike, double vol, double t, double sign) {
+        double sd = vol * std::sqrt(t);
+        if (!(sd > 0.0)) {
+            return std::max(sign * (forward - strike), 0.0);
+        }
+        double d1 = (std::log(forward / strike) + 0.5 * sd * sd) / sd;
+        double d2 = d1 - sd;
+        return sign * (forward * normCdf(sign * d1) - strike * normCdf(sign * d2));
+    }
+
+    // __restrict: without it GCC gives up on the runtime overlap checks between the columns
+    void impliedVolBatch(double forward, double t, const double* __restrict strike, const double* __restrict sign,
+                         const double* __restrict price, double* __restrict vol, size_t n) {
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        if (!(t > 0.0) || !(forward > 0.0)) {
+            std::fill(vol, vol + n, nan);
+            return;
+        }
+
+        const double sqrtT = std::sqrt(t);
+        const double tolerance = kPriceTolerance * forward;
+
+        // Masks are 0.0/1.0 doubles so every lane update is a blend, never a branch
+        double lo[kBlock], hi[kBlock], v[kBlock], target[kBlock], valid[kBlock], done[kBlock];
+
+        for (size_t base = 0; base < n; base += kBlock) {
+            const size_t m = std::min(kBlock, n - base);
+            const double* K = strike + base;
+            const double* s = sign + base;
+            const double* quoted = price + base;
+
+            // Scalar on purpose: the bit test keeps the vectorized loops below free of NaN
+            for (size_t i = 0; i < m; ++i) {
+                valid[i] = isFinite(quoted[i]) ? 1.0 : 0.0;
+                target[i] = valid[i] > 0.0 ? quoted[i] : 0.0;
+            }
+            for (size_t i = 0; i < m; ++i) {
+                double intrinsic = std::max(s[i] * (forward - K[i]), 0.0);
+                double upper = s[i] > 0.0 ? forward : K[i];
+                valid[i] = (valid[i] > 0.0 && target[i] > intrinsic && target[i] < upper) ? 1.0 : 0.0;
+                // Invalid lanes solve a harmless ATM-like problem so no NaN enters the loop
+                target[i] = valid[i] > 0.0 ? target[i] : 0.5 * (intrinsic + upper);
+                lo[i] = kMinVol;
+                hi[i] = kMaxVol;
+                done[i] = 1.0 - valid[i];
+                // Brenner-Subrahmanyam starting point
+                v[i] = std::min(std::max(kSqrt2Pi / sqrtT * target[i] / forward, 0.05), 3.0);
+            }
+
+            // A lane is frozen once its price is within tolerance, so converged lanes never
+            // step again while the rest of their block catches up
+            for (int iteration = 0; iteration < kMaxIterations; ++iteration) {
+                double pending = 0.0;
+                for (size_t i = 0; i < m; ++i) {
+                    double sd = v[i] * sqrtT;
+                    double d1 = (std::log(forward / K[i]) + 0.5 * sd * sd) / sd;
+                    double d2 = d1 - sd;
+                    double p = s[i] * (forward * normCdf(s[i] * d1) - K[i] * normCdf(s[i] * d2));
+                    double vega = forward * normPdf(d1) * sqrtT;
+                    double diff = p - target[i];
+                    double converged = std::fabs(diff) < tolerance ? 1.0 : 0.0;
+
+                    double above = diff > 0.0 ? 1.0 : 0.0;
+                    hi[i] = above * v[i] + (1.0 - above) * hi[i];
+                    lo[i] = above * lo[i] + (1.0 - above) * v[i];
+                    double newton = v[i] - diff / std::max(vega, 1e-300);
+                    // Inclusive: a step that lands on the bracket edge is still a Newton step
+                    double inside = (newton >= lo[i] && newton <= hi[i]) ? 1.0 : 0.0;
+                    double next = inside * newton + (1.0 - inside) * 0.5 * (lo[i] + hi[i]);
+
+                    double frozen = std::max(done[i], converged);
+                    v[i] = frozen * v[i] + (1.0 - frozen) * next;
+                    done[i] = frozen;
+                    pending += 1.0 - frozen;
+                }
+                if (pending == 0.0) {
+                    break;
+                }
+            }
+
+            for (size_t i = 0; i < m; ++i) {
+                vol[base + i] = valid[i] > 0.0 ? v[i] : nan;
+            }
+        }
+    }
+
+    void greeksBatch(double forward, double t, const double* __restrict strike, const double* __restrict sign, const double* __restrict vol,
+                     double* __restrict delta, double* __restrict gamma, double* __restrict vega, double* __restrict theta, size_t n) {
+        const double sqrtT = std::sqrt(t);
+        for (size_t i = 0; i < n; ++i) {
+            double sd = vol[i] * sqrtT;
+            double d1 = (std::log(forward / strike[i]) + 0.5 * sd * sd) / sd;
+            double pdf = normPdf(d1);
+            delta[i] = normCdf(d1) - (sign[i] < 0.0 ? 1.0 : 0.0);
+            gamma[i] = pdf / (forward * sd);
+            vega[i] = forward * pdf * sqrtT * 0.01;
+            theta[i] = -forward * pdf * vol[i] / (2.0 * sqrtT) / 365.0;
+        }
+    }
+}
@@ -1,23 +1,445 @@
 #include "order_manager.hpp"
+#include "memory_pool.hpp"
 #include "utils.hpp" 
+#include "config.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
 #include <string>
 #include <stdexcept>
 #include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
 
+namespace {
 
+    std::vector<OrderManager::Account> configuredAccounts() {
+        std::vector<OrderManager::Account> accounts{{API_KEY, SECRET_KEY}};
+        if (const char* extra = std::getenv("OEMS_ACCOUNTS")) {
+            std::stringstream list(extra);
+            std::string entry;
+            while (std::getline(list, entry, ',')) {
+                size_t separator = entry.find(':');
+                if (separator != std::string::npos) {
+                    accounts.push_back({entry.substr(0, separator), entry.substr(separator + 1)});
+                }
+            }
+        }
+        return accounts;
+    }
+
+    ExchangeSession::Transport configuredTransport() {
+        const char* transport = std::getenv("OEMS_ORDER_TRANSPORT");
+        return transport && std::strcmp(transport, "http") == 0 ? ExchangeSession::Transport::Http : ExchangeSession::Transport::WebSocket;
+    }
+
+    // Deribit instruments start with their currency ("BTC-PERPETUAL"); linear ones also name the settlement currency ("BTC_USDC-PERPETUAL")
+    bool instrumentInCurrency(const std::string& instrument, const std::string& currency) {
+        if (instrument.compare(0, currency.size(), currency) == 0 && instrument.size() > currency.size() &&
+            (instrument[currency.size()] == '-' || instrument[currency.size()] == '_')) {
+            return true;
+        }
+        return instrument.find("_" + currency + "-") != std::string::npos;
+    }
+
+    // Params go through a JSON writer, so client-supplied strings are escaped and cannot
+    // add fields of their own. One per thread, so the order paths reuse its buffer.
+    class ParamsWriter {
+    public:
+        static ParamsWriter& local() {
+            thread_local ParamsWriter writer;
+            return writer;
+        }
+
+        ParamsWriter& begin() {
+            m_buffer.Clear();
+            m_writer.Reset(m_buffer);
+            m_writer.StartObject();
+            return *this;
+        }
+
+        ParamsWriter& field(const char* key, const std::string& value) {
+            m_writer.Key(key);
+            m_writer.String(value.c_str(), static_cast<unsigned>(value.size()));
+            return *this;
+        }
+
+        ParamsWriter& field(const char* key, double value) {
+            m_writer.Key(key);
+            m_writer.Double(value);
+            return *this;
+        }
+
+        void end(std::string& out) {
+            m_writer.EndObject();
+            out.assign(m_buffer.GetString(), m_buffer.GetSize());
+        }
+
+        std::string end() {
+            std::string out;
+            end(out);
+            return out;
+        }
+
+    private:
+        ParamsWriter() : m_writer(m_buffer) {}
+
+        rapidjson::StringBuffer m_buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> m_writer;
+    };
+
+    const char* const kOrderTypes[] = {"limit", "market", "stop_limit", "stop_market", "take_limit", "take_market", "market_limit", "trailing_stop"};
+}
+
+// The side becomes part of the method name and the type is passed through, so both are checked
+// against what the exchange accepts; amounts must be finite to be written as JSON numbers.
+std::string OrderManager::validateOrder(const std::string& side, double quantity, double price, const std::string& orderType) {
+    if (side != "buy" && side != "sell") {
+        return "side must be buy or sell";
+    }
+    if (std::none_of(std::begin(kOrderTypes), std::end(kOrderTypes), [&orderType](const char* type) { return orderType == type; })) {
+        return "unsupported order type";
+    }
+    if (!std::isfinite(quantity) || !std::isfinite(price)) {
+        return "amount and price must be finite";
+    }
+    return "";
+}
+
+struct OrderManager::KillSwitchRun {
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    size_t remaining = 0;
+    KillSwitchReport report;
+    KillSwitchCallback done;
+};
+
+OrderManager::OrderManager(const StateSnapshot::State* restored)
+    : OrderManager(configuredAccounts(), UtilityNamespace::exchangeBaseUrl(), restored, configuredTransport()) {}
+
+OrderManager::OrderManager(const std::vector<Account>& accounts, const std::string& baseUrl, const StateSnapshot::State* restored,
+                           ExchangeSession::Transport transport)
+    : m_baseUrl(baseUrl), m_routingPolicy(RoutingPolicy::ByInstrument) {
+    for (const auto& account : accounts) {
+        m_sessions.push_back(std::make_unique<ExchangeSession>(account.clientId, account.clientSecret, baseUrl, transport));
+        size_t sessionIndex = m_sessions.size() - 1;
+        m_sessions.back()->setResponseObserver([this, sessionIndex](const RateLimitScheduler::Request& request, bool ok, const std::string& response) {
+            onSessionResponse(sessionIndex, request, ok, response);
+        });
+        // The exchange pulled the orders of a dropped connection; catch up once a new one is armed
+        m_sessions.back()->setConnectionObserver([this, sessionIndex, dropped = false](bool connected) mutable {
+            if (!connected) {
+                dropped = true;
+            } else if (dropped) {
+                dropped = false;
+                resyncOrders(sessionIndex);
+            }
+        });
+        m_sessions.back()->start();
+    }
+
+    if (restored) {
+        // Orders keep their session, so cancels after a restart still go to the right account
+        for (const auto& order : restored->orders) {
+            if (order.session < m_sessions.size()) {
+                m_orders[order.orderId] = TrackedOrder{order.session, order.instrument, order.direction, order.price, order.amount};
+            }
+        }
+        for (const auto& position : restored->positions) {
+            m_positions[position.instrument] = position;
+        }
+    }
+}
+
+OrderManager::~OrderManager() {
+    // Drain session callbacks while the bookkeeping they touch is still alive
+    for (auto& session : m_sessions) {
+        session->stop();
+    }
+}
+
+// Params are written into a caller-owned buffer; submit() copies them into a recycled request
+void OrderManager::orderParams(std::string& out, const std::string& instrumentName, double quantity, double price, const std::string& orderType) {
+    ParamsWriter::local().begin().field("instrument_name", instrumentName).field("amount", quantity).field("price", price).field("type", orderType).end(out);
+}
+
+void OrderManager::editParams(std::string& out, const std::string& order_id, double amount, double price) {
+    ParamsWriter::local().begin().field("order_id", order_id).field("amount", amount).field("price", price).end(out);
+}
+
+void OrderManager::stringParams(std::string& out, const char* key, const std::string& value) {
+    ParamsWriter::local().begin().field(key, value).end(out);
+}
+
+void OrderManager::setRoutingPolicy(RoutingPolicy policy) {
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    m_routingPolicy = policy;
+}
+
+void OrderManager::assignStrategy(const std::string& strategyTag, size_t sessionIndex) {
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    m_strategySessions[strategyTag] = sessionIndex % m_sessions.size();
+}
+
+size_t OrderManager::routeOrder(const std::string& instrumentName, const std::string& strategyTag) {
+    if (m_sessions.size() == 1) {
+        return 0;
+    }
+
+    RoutingPolicy policy;
+    {
+        std::lock_guard<std::mutex> lock(m_routingMutex);
+        policy = m_routingPolicy;
+        if (policy == RoutingPolicy::ByStrategyTag && !strategyTag.empty()) {
+            auto it = m_strategySessions.find(strategyTag);
+            return it != m_strategySessions.end() ? it->second : std::hash<std::string>{}(strategyTag) % m_sessions.size();
+        }
+    }
+
+    if (policy == RoutingPolicy::LeastLoaded) {
+        size_t best = 0;
+        double bestLoad = 0.0;
+        for (size_t i = 0; i < m_sessions.size(); ++i) {
+            RateLimitScheduler::Stats stats = m_sessions[i]->schedulerStats();
+            double load = stats.matchingUtilization + m_sessions[i]->inFlight() + stats.queued[RateLimitScheduler::Cancel] +
+                          stats.queued[RateLimitScheduler::Modify] + stats.queued[RateLimitScheduler::New];
+            if (i == 0 || load < bestLoad) {
+                best = i;
+                bestLoad = load;
+            }
+        }
+        return best;
+    }
+
+    // By instrument (also the fallback for untagged orders): one instrument always trades on one account
+    return std::hash<std::string>{}(instrumentName) % m_sessions.size();
+}
+
+size_t OrderManager::sessionIndexForOrder(const std::string& order_id) {
+    if (m_sessions.size() == 1) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    auto it = m_orders.find(order_id);
+    return it == m_orders.end() ? kAllSessions : it->second.session;
+}
 
-std::string OrderManager::placeOrder(const std::string& instrumentName,const std::string& type, double quantity, double price, const std::string& orderType) {
+// An order this process does not track (placed elsewhere, or before a restart without a
+// snapshot) is sent to every account: only the one holding it accepts, and its reply wins
+void OrderManager::submitForOrder(const std::string& method, const std::string& params, const std::string& order_id, ResponseCallback callback) {
+    size_t index = sessionIndexForOrder(order_id);
+    if (index != kAllSessions) {
+        m_sessions[index]->submit(method, params, std::move(callback), order_id);
+        return;
+    }
+    gatherAsync(method, params, [callback](GatheredResponses responses) {
+        for (const auto& [ok, response] : responses) {
+            if (ok && response.find("\"error\"") == std::string::npos) {
+                callback(true, response);
+                return;
+            }
+        }
+        auto answered = std::find_if(responses.begin(), responses.end(), [](const auto& response) { return response.first; });
+        const auto& reply = answered != responses.end() ? *answered : responses.front();
+        callback(reply.first, reply.second);
+    }, order_id);
+}
+
+void OrderManager::onSessionResponse(size_t sessionIndex, const RateLimitScheduler::Request& request, bool ok, const std::string& response) {
+    if (!ok) {
+        return;
+    }
+    if (request.method == "private/buy" || request.method == "private/sell" || request.method == "private/edit") {
+        rememberOrder(sessionIndex, response);
+    } else if (response.find("\"error\"") != std::string::npos) {
+        return;
+    } else if (request.method == "private/cancel") {
+        forgetOrder(request.orderId);
+    } else if (request.method.compare(0, 18, "private/cancel_all") == 0) {
+        forgetCancelled(sessionIndex, request.method, request.params);
+    }
+}
+
+// Place and edit responses both carry the order as it now stands. Runs once per order
+// on the session worker, so it parses into the thread's arena and reuses map nodes.
+void OrderManager::rememberOrder(size_t sessionIndex, const std::string& response) {
+    JsonArena::Document& doc = JsonArena::local().parse(response);
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("result") || !doc["result"].IsObject() ||
+        !doc["result"].HasMember("order") || !doc["result"]["order"].HasMember("order_id")) {
+        return;
+    }
+    const auto& order = doc["result"]["order"];
+    const char* state = order.HasMember("order_state") ? order["order_state"].GetString() : "open";
+    bool open = std::strcmp(state, "open") == 0 || std::strcmp(state, "untriggered") == 0;
+
+    thread_local std::string orderId;
+    orderId.assign(order["order_id"].GetString(), order["order_id"].GetStringLength());
+
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    auto it = m_orders.find(orderId);
+    if (!open) {
+        if (it != m_orders.end()) {
+            auto node = m_orders.extract(it);
+            if (m_spareOrders.size() < kMaxSpareOrders) {
+                m_spareOrders.push_back(std::move(node));
+            }
+        }
+        return;
+    }
+    if (it == m_orders.end()) {
+        if (m_spareOrders.empty()) {
+            it = m_orders.try_emplace(orderId).first;
+        } else {
+            OrderMap::node_type node = std::move(m_spareOrders.back());
+            m_spareOrders.pop_back();
+            node.key().assign(orderId);
+            it = m_orders.insert(std::move(node)).position;
+        }
+    }
+    TrackedOrder& tracked = it->second;
+    tracked.session = sessionIndex;
+    tracked.instrument.assign(order.HasMember("instrument_name") ? order["instrument_name"].GetString() : "");
+    tracked.direction.assign(order.HasMember("direction") ? order["direction"].GetString() : "");
+    tracked.price = (order.HasMember("price") && order["price"].IsNumber()) ? order["price"].GetDouble() : 0.0;
+    tracked.amount = (order.HasMember("amount") && order["amount"].IsNumber()) ? order["amount"].GetDouble() : 0.0;
+}
+
+void OrderManager::forgetOrder(const std::string& order_id) {
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    auto node = m_orders.extract(order_id);
+    if (!node.empty() && m_spareOrders.size() < kMaxSpareOrders) {
+        m_spareOrders.push_back(std::move(node));
+    }
+}
+
+bool OrderManager::tracksOrder(const std::string& order_id) {
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    return m_orders.count(order_id) != 0;
+}
+
+void OrderManager::forgetCancelled(size_t sessionIndex, const std::string& method, const std::string& params) {
+    std::string instrument;
+    std::string currency;
+    JsonArena::Document& doc = JsonArena::local().parse(params);
+    if (!doc.HasParseError() && doc.IsObject()) {
+        if (doc.HasMember("instrument_name") && doc["instrument_name"].IsString()) {
+            instrument = doc["instrument_name"].GetString();
+        }
+        if (doc.HasMember("currency") && doc["currency"].IsString()) {
+            currency = doc["currency"].GetString();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_routingMutex);
+    for (auto it = m_orders.begin(); it != m_orders.end();) {
+        const TrackedOrder& order = it->second;
+        bool cancelled = order.session == sessionIndex &&
+                         (method == "private/cancel_all" ||
+                          (method == "private/cancel_all_by_instrument" && order.instrument == instrument) ||
+                          (method == "private/cancel_all_by_currency" && instrumentInCurrency(order.instrument, currency)));
+        it = cancelled ? m_orders.erase(it) : std::next(it);
+    }
+}
+
+void OrderManager::resyncOrders(size_t sessionIndex) {
+    m_sessions[sessionIndex]->submit("private/get_open_orders", "{}", [this, sessionIndex](bool ok, const std::string& response) {
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (!ok || doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+            std::cerr << "Could not refresh open orders after reconnecting: " << response << std::endl;
+            return;
+        }
+        std::set<std::string> open;
+        for (const auto& order : doc["result"].GetArray()) {
+            if (order.HasMember("order_id") && order["order_id"].IsString()) {
+                open.insert(order["order_id"].GetString());
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_routingMutex);
+        for (auto it = m_orders.begin(); it != m_orders.end();) {
+            it = (it->second.session == sessionIndex && open.count(it->first) == 0) ? m_orders.erase(it) : std::next(it);
+        }
+    });
+}
+
+void OrderManager::gatherAsync(const std::string& method, const std::string& params, std::function<void(GatheredResponses)> done, const std::string& orderId) {
+    struct Gather {
+        std::mutex mutex;
+        GatheredResponses responses;
+        size_t remaining;
+    };
+    auto gathered = std::make_shared<Gather>();
+    gathered->responses.resize(m_sessions.size());
+    gathered->remaining = m_sessions.size();
+
+    for (size_t i = 0; i < m_sessions.size(); ++i) {
+        m_sessions[i]->submit(method, params, [gathered, i, done](bool ok, const std::string& response) {
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(gathered->mutex);
+                gathered->responses[i] = {ok, response};
+                last = --gathered->remaining == 0;
+            }
+            if (last) {
+                done(std::move(gathered->responses));
+            }
+        }, orderId);
+    }
+}
+
+OrderManager::GatheredResponses OrderManager::gather(const std::string& method, const std::string& params) {
+    auto promise = std::make_shared<std::promise<GatheredResponses>>();
+    auto future = promise->get_future();
+    gatherAsync(method, params, [promise](GatheredResponses responses) {
+        promise->set_value(std::move(responses));
+    });
+
+    GatheredResponses responses = future.get();
+    for (const auto& [ok, response] : responses) {
+        if (!ok) {
+            throw std::runtime_error(response);
+        }
+    }
+    return responses;
+}
+
+// Mass-cancel results are counts; add them up, or pass the first failure through
+std::string OrderManager::sumResults(const GatheredResponses& responses) {
+    if (responses.size() == 1) {
+        return responses.front().second;
+    }
+    uint64_t total = 0;
+    for (const auto& [ok, response] : responses) {
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (!ok || doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsUint64()) {
+            return response;
+        }
+        total += doc["result"].GetUint64();
+    }
+    return "{\"jsonrpc\":\"2.0\", \"result\":" + std::to_string(total) + "}";
+}
+
+std::string OrderManager::placeOrder(const std::string& instrumentName,const std::string& type, double quantity, double price, const std::string& orderType, const std::string& strategyTag) {
     try 
     {
-        std::string accessToken = UtilityNamespace::authenticate();
-        std::string url = "https://test.deribit.com/api/v2/private/" + type;
-        std::string payload = "{\"jsonrpc\":\"2.0\", \"id\":1, \"method\":\"private/" + type + "\", \"params\":{\"instrument_name\":\"" 
-                              + instrumentName + "\", \"amount\":" + std::to_string(quantity) + ", \"price\":" 
-                              + std::to_string(price) + ", \"type\":\"" + orderType + "\"}}";
-        std::string authHeader = "Authorization: Bearer " + accessToken;
-        std::string response = UtilityNamespace::sendPostRequestWithAuth(url, payload, authHeader);
-        return response;
+        std::string invalid = validateOrder(type, quantity, price, orderType);
+        if (!invalid.empty()) {
+            throw std::invalid_argument(invalid);
+        }
+        if (m_killSwitchEngaged) {
+            throw std::runtime_error("Kill switch engaged; re-arm before trading");
+        }
+        std::string params;
+        orderParams(params, instrumentName, quantity, price, orderType);
+        return m_sessions[routeOrder(instrumentName, strategyTag)]->call("private/" + type, params);
     } 
     catch (const std::exception& e) 
     {
@@ -28,12 +450,19 @@ std::string OrderManager::placeOrder(const std::string& instrumentName,const std
 std::string OrderManager::cancelOrder(const std::string& orderId) {
     try 
     {
-        std::string accessToken = UtilityNamespace::authenticate();
-        std::string url = "https://test.deribit.com/api/v2/private/cancel";
-        std::string payload = "{\"jsonrpc\":\"2.0\", \"id\":1, \"method\":\"private/cancel\", \"params\":{\"order_id\":\"" 
-                              + orderId + "\"}}";
-        std::string authHeader = "Authorization: Bearer " + accessToken;
-        std::string response = UtilityNamespace::sendPostRequestWithAuth(url, payload, authHeader);
+        dropPendingAmend(orderId);
+        std::string params;
+        stringParams(params, "order_id", orderId);
+        auto promise = std::make_shared<std::promise<std::pair<bool, std::string>>>();
+        auto future = promise->get_future();
+        submitForOrder("private/cancel", params, orderId, [promise](bool ok, const std::string& response) {
+            promise->set_value({ok, response});
+        });
+
+        auto [ok, response] = future.get();
+        if (!ok) {
+            throw std::runtime_error(response);
+        }
         return response;
     } 
     catch (const std::exception& e) 
@@ -45,13 +474,16 @@ std::string OrderManager::cancelOrder(const std::string& orderId) {
 std::string OrderManager::modifyOrder(const std::string& order_id, double amount, double price) {
     try 
     {
-        std::string accessToken = UtilityNamespace::authenticate();
-        std::string url = "https://test.deribit.com/api/v2/private/edit";
-        std::string payload = "{\"jsonrpc\":\"2.0\", \"id\":1, \"method\":\"private/edit\", \"params\":{\"order_id\":\"" 
-                      + order_id + "\", \"amount\":" + std::to_string(amount) + ", \"price\":" 
-                      + std::to_string(price) + "}}"; 
-        std::string authHeader = "Authorization: Bearer " + accessToken;
-        std::string response = UtilityNamespace::sendPostRequestWithAuth(url, payload, authHeader);
+        auto promise = std::make_shared<std::promise<std::pair<bool, std::string>>>();
+        auto future = promise->get_future();
+        modifyOrderAsync(order_id, amount, price, [promise](bool ok, const std::string& response) {
+            promise->set_value({ok, response});
+        });
+
+        auto [ok, response] = future.get();
+        if (!ok) {
+            throw std::runtime_error(response);
+        }
         return response;
     } 
     catch (const std::exception& e) 
@@ -60,10 +492,306 @@ std::string OrderManager::modifyOrder(const std::string& order_id, double amount
     }
 }
 
+std::string OrderManager::cancelAll() {
+    try 
+    {
+        dropAllPendingAmends();
+        return sumResults(gather("private/cancel_all", "{}"));
+    } 
+    catch (const std::exception& e) 
+    {
+        return "Error while canceling all orders: " + std::string(e.what());
+    }
+}
+
+std::string OrderManager::cancelAllByInstrument(const std::string& instrumentName) {
+    try 
+    {
+        dropAllPendingAmends();
+        return sumResults(gather("private/cancel_all_by_instrument", ParamsWriter::local().begin().field("instrument_name", instrumentName).end()));
+    } 
+    catch (const std::exception& e) 
+    {
+        return "Error while canceling orders by instrument: " + std::string(e.what());
+    }
+}
+
+std::string OrderManager::cancelAllByCurrency(const std::string& currency) {
+    try 
+    {
+        dropAllPendingAmends();
+        return sumResults(gather("private/cancel_all_by_currency", ParamsWriter::local().begin().field("currency", currency).end()));
+    } 
+    catch (const std::exception& e) 
+    {
+        return "Error while canceling orders by currency: " + std::string(e.what());
+    }
+}
+
+void OrderManager::cancelAllAsync(const std::string& currency, const std::string& instrumentName, ResponseCallback callback) {
+    dropAllPendingAmends();
+    auto done = [callback](GatheredResponses responses) {
+        bool ok = std::all_of(responses.begin(), responses.end(), [](const auto& response) { return response.first; });
+        callback(ok, sumResults(responses));
+    };
+    if (!instrumentName.empty()) {
+        gatherAsync("private/cancel_all_by_instrument", ParamsWriter::local().begin().field("instrument_name", instrumentName).end(), done);
+    } else if (!currency.empty()) {
+        gatherAsync("private/cancel_all_by_currency", ParamsWriter::local().begin().field("currency", currency).end(), done);
+    } else {
+        gatherAsync("private/cancel_all", "{}", done);
+    }
+}
+
+void OrderManager::triggerKillSwitch(KillSwitchCallback done) {
+    auto run = std::make_shared<KillSwitchRun>();
+    run->start = std::chrono::steady_clock::now();
+    run->remaining = m_sessions.size();
+    run->report.ok = true;
+    run->report.flat = true;
+    run->done = std::move(done);
+
+    // Latched before the queues are emptied, so nothing can slip in behind the trigger
+    m_killSwitchEngaged = true;
+    // Nothing queued behind the trigger may reach the exchange
+    for (auto& session : m_sessions) {
+        session->discardQueuedOrderFlow();
+    }
+    dropAllPendingAmends();
+
+    for (size_t i = 0; i < m_sessions.size(); ++i) {
+        m_sessions[i]->submit("private/cancel_all", "{}", [this, run, i](bool ok, const std::string& response) {
+            int64_t ackMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - run->start).count();
+            rapidjson::Document doc;
+            doc.Parse(response.c_str());
+            bool accepted = ok && !doc.HasParseError() && doc.HasMember("result");
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                run->report.ackMicros = std::max(run->report.ackMicros, ackMicros);
+                if (accepted && doc["result"].IsUint64()) {
+                    run->report.cancelled += doc["result"].GetUint64();
+                }
+            }
+            if (!accepted) {
+                finishKillSwitchSession(run, false, false, response);
+                return;
+            }
+            confirmFlat(i, run, kFlatCheckAttempts);
+        });
+    }
+}
+
+OrderManager::KillSwitchReport OrderManager::killSwitch() {
+    auto promise = std::make_shared<std::promise<KillSwitchReport>>();
+    auto future = promise->get_future();
+    triggerKillSwitch([promise](const KillSwitchReport& report) {
+        promise->set_value(report);
+    });
+    return future.get();
+}
+
+OrderManager::KillSwitchReport OrderManager::lastKillSwitch() {
+    std::lock_guard<std::mutex> lock(m_killSwitchMutex);
+    return m_lastKillSwitch;
+}
+
+void OrderManager::rearm() {
+    m_killSwitchEngaged = false;
+}
+
+// Orders can race the cancel (e.g. an order acknowledged just after it), so
+// check that nothing is left open and sweep again if something is.
+void OrderManager::confirmFlat(size_t sessionIndex, std::shared_ptr<KillSwitchRun> run, int attempts) {
+    m_sessions[sessionIndex]->submit("private/get_open_orders", "{}", [this, sessionIndex, run, attempts](bool ok, const std::string& response) {
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (!ok || doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+            finishKillSwitchSession(run, true, false, response);
+            return;
+        }
+
+        if (doc["result"].Empty()) {
+            finishKillSwitchSession(run, true, true, "");
+            return;
+        }
+
+        if (attempts <= 1) {
+            finishKillSwitchSession(run, true, false, "Orders still open after " + std::to_string(kFlatCheckAttempts) + " sweeps");
+            return;
+        }
+
+        m_sessions[sessionIndex]->submit("private/cancel_all", "{}", [this, sessionIndex, run, attempts](bool ok, const std::string& response) {
+            rapidjson::Document sweep;
+            sweep.Parse(response.c_str());
+            if (ok && !sweep.HasParseError() && sweep.HasMember("result") && sweep["result"].IsUint64()) {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                run->report.cancelled += sweep["result"].GetUint64();
+            }
+            confirmFlat(sessionIndex, run, attempts - 1);
+        });
+    });
+}
+
+// The kill switch completes once every session has either confirmed flat or failed
+void OrderManager::finishKillSwitchSession(std::shared_ptr<KillSwitchRun> run, bool accepted, bool flat, const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(run->mutex);
+        run->report.ok = run->report.ok && accepted;
+        run->report.flat = run->report.flat && flat;
+        if (!flat && run->report.error.empty()) {
+            run->report.error = error;
+        }
+        if (--run->remaining > 0) {
+            return;
+        }
+        if (run->report.flat) {
+            run->report.flatMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - run->start).count();
+        }
+    }
+
+    if (run->report.flat) {
+        std::lock_guard<std::mutex> lock(m_routingMutex);
+        m_orders.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_killSwitchMutex);
+        m_lastKillSwitch = run->report;
+    }
+    run->done(run->report);
+}
+
+// The hot path: tracking happens in onSessionResponse(), so the caller's callback is
+// passed through unwrapped and the request text is built in per-thread buffers.
+void OrderManager::placeOrderAsync(const std::string& instrumentName, const std::string& type, double quantity, double price, const std::string& orderType, ResponseCallback callback, const std::string& strategyTag) {
+    std::string invalid = validateOrder(type, quantity, price, orderType);
+    if (!invalid.empty()) {
+        callback(false, "{\"error\": \"" + invalid + "\"}");
+        return;
+    }
+    if (m_killSwitchEngaged) {
+        callback(false, R"({"error": "Kill switch engaged; re-arm before trading"})");
+        return;
+    }
+    thread_local std::string method;
+    thread_local std::string params;
+    method.assign("private/").append(type);
+    orderParams(params, instrumentName, quantity, price, orderType);
+    m_sessions[routeOrder(instrumentName, strategyTag)]->submit(method, params, std::move(callback));
+}
+
+void OrderManager::cancelOrderAsync(const std::string& orderId, ResponseCallback callback) {
+    dropPendingAmend(orderId);
+    thread_local std::string params;
+    stringParams(params, "order_id", orderId);
+    submitForOrder("private/cancel", params, orderId, std::move(callback));
+}
+
+void OrderManager::modifyOrderAsync(const std::string& order_id, double amount, double price, ResponseCallback callback) {
+    if (m_killSwitchEngaged) {
+        callback(false, R"({"error": "Kill switch engaged; re-arm before trading"})");
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_amendMutex);
+        ++m_amendStats.requested;
+        auto [it, inserted] = m_amends.try_emplace(order_id);
+        if (!inserted) {
+            // An edit is already on the wire: park this one, replacing any edit parked before it
+            AmendState& state = it->second;
+            if (state.hasPending) {
+                ++m_amendStats.coalesced;
+                ++state.coalesced;
+            }
+            state.hasPending = true;
+            state.amount = amount;
+            state.price = price;
+            state.callbacks.push_back(std::move(callback));
+            return;
+        }
+        ++m_amendStats.sent;
+    }
+
+    std::vector<ResponseCallback> callbacks;
+    callbacks.push_back(std::move(callback));
+    sendAmend(order_id, amount, price, std::move(callbacks));
+}
+
+OrderManager::AmendStats OrderManager::amendStats() {
+    std::lock_guard<std::mutex> lock(m_amendMutex);
+    return m_amendStats;
+}
+
+void OrderManager::sendAmend(const std::string& order_id, double amount, double price, std::vector<ResponseCallback> callbacks) {
+    auto waiting = std::make_shared<std::vector<ResponseCallback>>(std::move(callbacks));
+    std::string params;
+    editParams(params, order_id, amount, price);
+    submitForOrder("private/edit", params, order_id, [this, order_id, waiting](bool ok, const std::string& response) {
+        // Release the next parked edit before notifying, so it is not delayed by slow callers
+        onAmendComplete(order_id);
+        for (auto& callback : *waiting) {
+            callback(ok, response);
+        }
+    });
+}
+
+void OrderManager::onAmendComplete(const std::string& order_id) {
+    AmendState next;
+    {
+        std::lock_guard<std::mutex> lock(m_amendMutex);
+        auto it = m_amends.find(order_id);
+        if (it == m_amends.end()) {
+            return;
+        }
+        if (!it->second.hasPending) {
+            m_amends.erase(it);
+            return;
+        }
+        next = std::move(it->second);
+        it->second = AmendState();
+        ++m_amendStats.sent;
+    }
+    sendAmend(order_id, next.amount, next.price, std::move(next.callbacks));
+}
+
+void OrderManager::dropAllPendingAmends() {
+    std::vector<ResponseCallback> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_amendMutex);
+        for (auto& [orderId, state] : m_amends) {
+            // Only the parked edit itself is dropped; the edits it replaced were counted as coalesced
+            m_amendStats.dropped += state.callbacks.size() - state.coalesced;
+            for (auto& callback : state.callbacks) {
+                dropped.push_back(std::move(callback));
+            }
+            state = AmendState();
+        }
+    }
+    for (auto& callback : dropped) {
+        callback(false, R"({"error": "Superseded by a mass cancel"})");
+    }
+}
+
+void OrderManager::dropPendingAmend(const std::string& order_id) {
+    std::vector<ResponseCallback> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_amendMutex);
+        auto it = m_amends.find(order_id);
+        if (it == m_amends.end() || !it->second.hasPending) {
+            return;
+        }
+        m_amendStats.dropped += it->second.callbacks.size() - it->second.coalesced;
+        dropped = std::move(it->second.callbacks);
+        it->second = AmendState();
+    }
+    for (auto& callback : dropped) {
+        callback(false, R"({"error": "Superseded by a cancel of the same order"})");
+    }
+}
+
 std::string OrderManager::getOrderBook(const std::string& symbol) {
     try 
     {
-        std::string url = "https://test.deribit.com/api/v2/public/get_order_book?instrument_name=" + symbol;
+        std::string url = m_baseUrl + "/public/get_order_book?instrument_name=" + UtilityNamespace::urlEncode(symbol);
         std::string response = UtilityNamespace::sendGetRequest(url);
         return response;
     } 
@@ -76,13 +804,102 @@ std::string OrderManager::getOrderBook(const std::string& symbol) {
 std::string OrderManager::getCurrentPositions(const std::string& currency) {
     try 
     {
-        std::string accessToken = UtilityNamespace::authenticate();
-        std::string url = "https://test.deribit.com/api/v2/private/get_positions";
-        std::string payload = "{\"jsonrpc\":\"2.0\", \"id\":1, \"method\":\"private/get_positions\", "
-                              "\"params\":{\"currency\":\"" + currency + "\"}}";
-        std::string authHeader = "Authorization: Bearer " + accessToken;
-        std::string response = UtilityNamespace::sendPostRequestWithAuth(url, payload, authHeader);
-        return response;
+        GatheredResponses responses = gather("private/get_positions", ParamsWriter::local().begin().field("currency", currency).end());
+        if (responses.size() == 1) {
+            rememberPositions(currency, responses.front().second);
+            return responses.front().second;
+        }
+
+        // Net positions per instrument. The net average price weighs each account's average by its
+        // signed size, so it is the price at which the net position breaks even (+10@100 and
+        // -5@110 net to +5@90); every account's own size and average are listed alongside it.
+        struct Leg {
+            size_t account;
+            double size;
+            double averagePrice;
+        };
+        struct Net {
+            std::string instrument;
+            double size = 0, notional = 0, floatingPnl = 0, realizedPnl = 0, leverage = 0;
+            int accounts = 0;
+            std::vector<Leg> legs;
+        };
+        std::vector<Net> nets;
+        std::unordered_map<std::string, size_t> byInstrument;
+        for (size_t account = 0; account < responses.size(); ++account) {
+            const std::string& response = responses[account].second;
+            rapidjson::Document doc;
+            doc.Parse(response.c_str());
+            if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+                return response;
+            }
+            for (const auto& position : doc["result"].GetArray()) {
+                if (!position.HasMember("instrument_name") || !position.HasMember("size")) {
+                    continue;
+                }
+                std::string instrument = position["instrument_name"].GetString();
+                auto [it, inserted] = byInstrument.try_emplace(instrument, nets.size());
+                if (inserted) {
+                    nets.emplace_back();
+                    nets.back().instrument = instrument;
+                }
+                Net& net = nets[it->second];
+                double size = position["size"].GetDouble();
+                double averagePrice = position.HasMember("average_price") ? position["average_price"].GetDouble() : 0.0;
+                net.size += size;
+                net.notional += size * averagePrice;
+                net.legs.push_back({account, size, averagePrice});
+                net.floatingPnl += position.HasMember("floating_profit_loss") ? position["floating_profit_loss"].GetDouble() : 0.0;
+                net.realizedPnl += position.HasMember("realized_profit_loss") ? position["realized_profit_loss"].GetDouble() : 0.0;
+                net.leverage = std::max(net.leverage, position.HasMember("leverage") ? position["leverage"].GetDouble() : 0.0);
+                ++net.accounts;
+            }
+        }
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("jsonrpc");
+        writer.String("2.0");
+        writer.Key("result");
+        writer.StartArray();
+        for (const auto& net : nets) {
+            writer.StartObject();
+            writer.Key("instrument_name");
+            writer.String(net.instrument.c_str());
+            writer.Key("size");
+            writer.Double(net.size);
+            writer.Key("average_price");
+            writer.Double(net.size != 0 ? net.notional / net.size : 0.0);
+            writer.Key("floating_profit_loss");
+            writer.Double(net.floatingPnl);
+            writer.Key("realized_profit_loss");
+            writer.Double(net.realizedPnl);
+            writer.Key("leverage");
+            writer.Double(net.leverage);
+            writer.Key("direction");
+            writer.String(net.size > 0 ? "buy" : net.size < 0 ? "sell" : "zero");
+            writer.Key("accounts");
+            writer.Int(net.accounts);
+            writer.Key("per_account");
+            writer.StartArray();
+            for (const auto& leg : net.legs) {
+                writer.StartObject();
+                writer.Key("account");
+                writer.Uint64(leg.account);
+                writer.Key("size");
+                writer.Double(leg.size);
+                writer.Key("average_price");
+                writer.Double(leg.averagePrice);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+        rememberPositions(currency, buffer.GetString());
+        return buffer.GetString();
     } 
     catch (const std::exception& e) 
     {
@@ -90,10 +907,183 @@ std::string OrderManager::getCurrentPositions(const std::string& currency) {
     }
 }
 
+// Replaces the cached positions of one currency with a (possibly merged) get_positions response
+void OrderManager::rememberPositions(const std::string& currency, const std::string& response) {
+    rapidjson::Document doc;
+    doc.Parse(response.c_str());
+    if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_positionMutex);
+    for (auto it = m_positions.begin(); it != m_positions.end();) {
+        it = (currency == "any" || instrumentInCurrency(it->first, currency)) ? m_positions.erase(it) : std::next(it);
+    }
+    for (const auto& position : doc["result"].GetArray()) {
+        if (!position.HasMember("instrument_name") || !position.HasMember("size") || position["size"].GetDouble() == 0.0) {
+            continue;
+        }
+        StateSnapshot::Position& cached = m_positions[position["instrument_name"].GetString()];
+        cached.instrument = position["instrument_name"].GetString();
+        cached.size = position["size"].GetDouble();
+        cached.averagePrice = (position.HasMember("average_price") && position["average_price"].IsNumber()) ? position["average_price"].GetDouble() : 0.0;
+    }
+}
+
+void OrderManager::exportState(StateSnapshot::State& state) {
+    for (const auto& session : m_sessions) {
+        if (int64_t expiresAtMs = session->tokenExpiresAtMs()) {
+            state.tokenExpiries.push_back({session->clientId(), expiresAtMs});
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_routingMutex);
+        for (const auto& [orderId, order] : m_orders) {
+            state.orders.push_back({orderId, order.instrument, order.direction, order.price, order.amount, static_cast<uint32_t>(order.session)});
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_positionMutex);
+    for (const auto& [instrument, position] : m_positions) {
+        state.positions.push_back(position);
+    }
+}
+
+// Fetches only what can have moved while the process was down: each session's open
+// orders, and positions for the currencies the snapshot held positions in.
+OrderManager::ReconcileReport OrderManager::reconcile() {
+    ReconcileReport report;
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        // Orders tracked before the fetch; ones placed or forgotten while it runs are newer than its answer
+        std::set<std::string> known;
+        {
+            std::lock_guard<std::mutex> lock(m_routingMutex);
+            for (const auto& [orderId, order] : m_orders) {
+                known.insert(orderId);
+            }
+        }
+        GatheredResponses responses = gather("private/get_open_orders", "{}");
+        std::unordered_map<std::string, TrackedOrder> live;
+        for (size_t i = 0; i < responses.size(); ++i) {
+            rapidjson::Document doc;
+            doc.Parse(responses[i].second.c_str());
+            if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+                throw std::runtime_error(responses[i].second);
+            }
+            for (const auto& order : doc["result"].GetArray()) {
+                if (!order.HasMember("order_id")) {
+                    continue;
+                }
+                TrackedOrder& tracked = live[order["order_id"].GetString()];
+                tracked.session = i;
+                tracked.instrument = order.HasMember("instrument_name") ? order["instrument_name"].GetString() : "";
+                tracked.direction = order.HasMember("direction") ? order["direction"].GetString() : "";
+                tracked.price = (order.HasMember("price") && order["price"].IsNumber()) ? order["price"].GetDouble() : 0.0;
+                tracked.amount = (order.HasMember("amount") && order["amount"].IsNumber()) ? order["amount"].GetDouble() : 0.0;
+            }
+        }
+
+        // Merged into the live map, so order flow that raced the fetch is not lost
+        {
+            std::lock_guard<std::mutex> lock(m_routingMutex);
+            for (auto& [orderId, order] : live) {
+                auto it = m_orders.find(orderId);
+                if (it == m_orders.end()) {
+                    // Forgotten since the fetch (cancelled or filled meanwhile); only unknown orders are new
+                    if (known.count(orderId) == 0) {
+                        ++report.ordersAdded;
+                        m_orders.emplace(orderId, std::move(order));
+                    }
+                } else if (it->second.price != order.price || it->second.amount != order.amount) {
+                    ++report.ordersChanged;
+                    it->second = std::move(order);
+                } else {
+                    ++report.ordersKept;
+                }
+            }
+            for (auto it = m_orders.begin(); it != m_orders.end();) {
+                if (known.count(it->first) && live.count(it->first) == 0) {
+                    ++report.ordersRemoved;
+                    it = m_orders.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // Every currency, not just those the snapshot held: positions may have opened while we were down
+        std::unordered_map<std::string, StateSnapshot::Position> before;
+        {
+            std::lock_guard<std::mutex> lock(m_positionMutex);
+            before = m_positions;
+        }
+        getCurrentPositions("any");
+        std::lock_guard<std::mutex> lock(m_positionMutex);
+        for (const auto& [instrument, position] : m_positions) {
+            auto it = before.find(instrument);
+            report.positionsChanged += (it == before.end() || it->second.size != position.size);
+        }
+        for (const auto& [instrument, position] : before) {
+            report.positionsChanged += m_positions.count(instrument) == 0;
+        }
+        report.ok = true;
+    }
+    catch (const std::exception& e)
+    {
+        report.error = "Error while reconciling orders: " + std::string(e.what());
+    }
+    report.micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+std::string OrderManager::getOpenOrders() {
+    try
+    {
+        GatheredResponses responses = gather("private/get_open_orders", "{}");
+        if (responses.size() == 1) {
+            return responses.front().second;
+        }
+
+        // Concatenate every session's orders, tagging each with the session it lives on
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("jsonrpc");
+        writer.String("2.0");
+        writer.Key("result");
+        writer.StartArray();
+        for (size_t i = 0; i < responses.size(); ++i) {
+            rapidjson::Document doc;
+            doc.Parse(responses[i].second.c_str());
+            if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+                return responses[i].second;
+            }
+            for (const auto& order : doc["result"].GetArray()) {
+                writer.StartObject();
+                for (auto member = order.MemberBegin(); member != order.MemberEnd(); ++member) {
+                    writer.Key(member->name.GetString());
+                    member->value.Accept(writer);
+                }
+                writer.Key("account");
+                writer.Uint64(i);
+                writer.EndObject();
+            }
+        }
+        writer.EndArray();
+        writer.EndObject();
+        return buffer.GetString();
+    }
+    catch (const std::exception& e)
+    {
+        return "Error while fetching open orders: " + std::string(e.what());
+    }
+}
+
 std::string OrderManager::getInstruments() {
     try 
     {
-        std::string url = "https://test.deribit.com/api/v2/public/get_instruments";
+        std::string url = m_baseUrl + "/public/get_instruments";
         return UtilityNamespace::sendGetRequest(url); 
     } 
     catch(const std::exception& e) 
@@ -105,7 +1095,7 @@ std::string OrderManager::getInstruments() {
 std::string OrderManager::getInstrumentOrderbook(const std::string& instrumentName) {
     try 
     {
-        std::string url = "https://test.deribit.com/api/v2/public/get_order_book?instrument_name=" + instrumentName;
+        std::string url = m_baseUrl + "/public/get_order_book?instrument_name=" + UtilityNamespace::urlEncode(instrumentName);
         return UtilityNamespace::sendGetRequest(url); 
     } 
     catch(const std::exception& e) 
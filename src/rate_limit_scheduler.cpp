@@ -0,0 +1,207 @@
+#include "rate_limit_scheduler.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace {
+    // One queue per priority, all drawing from the scheduler's pool
+    template <size_t... Priorities>
+    std::array<std::pmr::deque<RateLimitScheduler::Request>, sizeof...(Priorities)> makeQueues(std::pmr::memory_resource* pool,
+                                                                                                std::index_sequence<Priorities...>) {
+        return {{((void)Priorities, std::pmr::deque<RateLimitScheduler::Request>(pool))...}};
+    }
+}
+
+RateLimitScheduler::RateLimitScheduler(Limits matching, Limits nonMatching)
+    : m_queues(makeQueues(&m_pool, std::make_index_sequence<PriorityCount>())),
+      m_matching{matching, matching.maxCredits, Clock::now()},
+      m_nonMatching{nonMatching, nonMatching.maxCredits, Clock::now()} {}
+
+void RateLimitScheduler::setLimits(Limits matching, Limits nonMatching) {
+    auto now = Clock::now();
+    m_matching = Bucket{matching, matching.maxCredits, now};
+    m_nonMatching = Bucket{nonMatching, nonMatching.maxCredits, now};
+}
+
+void RateLimitScheduler::Bucket::refill(Clock::time_point now) {
+    if (now <= updated) {
+        return;
+    }
+    double elapsed = std::chrono::duration<double>(now - updated).count();
+    credits = std::min(limits.maxCredits, credits + elapsed * limits.refillPerSecond);
+    updated = now;
+}
+
+RateLimitScheduler::Priority RateLimitScheduler::classify(const std::string& method) {
+    if (method.find("/cancel") != std::string::npos) {
+        return Cancel;
+    }
+    if (method == "private/edit" || method == "private/edit_by_label") {
+        return Modify;
+    }
+    if (method == "private/buy" || method == "private/sell" || method == "private/close_position") {
+        return New;
+    }
+    return MarketData;
+}
+
+bool RateLimitScheduler::isMatchingEngine(const std::string& method) {
+    return classify(method) != MarketData;
+}
+
+RateLimitScheduler::Bucket& RateLimitScheduler::bucketFor(const std::string& method) {
+    return isMatchingEngine(method) ? m_matching : m_nonMatching;
+}
+
+std::vector<RateLimitScheduler::ResponseCallback> RateLimitScheduler::enqueue(Request request, Clock::time_point now) {
+    std::vector<ResponseCallback> dropped;
+    Priority priority = classify(request.method);
+    auto& queue = m_queues[priority];
+    request.enqueued = now;
+
+    auto sameOrder = [&request](const Request& queued) {
+        return !request.orderId.empty() && queued.orderId == request.orderId && queued.method == request.method;
+    };
+
+    if (priority == Cancel && !request.orderId.empty()) {
+        auto& modifies = m_queues[Modify];
+        for (auto it = modifies.begin(); it != modifies.end();) {
+            if (it->orderId == request.orderId) {
+                for (auto& callback : it->callbacks) {
+                    dropped.push_back(std::move(callback));
+                }
+                it = modifies.erase(it);
+                ++m_stats.dropped;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    if (priority == Modify || priority == Cancel) {
+        auto it = std::find_if(queue.begin(), queue.end(), sameOrder);
+        if (it != queue.end()) {
+            // Newest edit wins; earlier callers get the response of the edit that actually goes out
+            it->params = std::move(request.params);
+            for (auto& callback : request.callbacks) {
+                it->callbacks.push_back(std::move(callback));
+            }
+            ++m_stats.merged;
+            return dropped;
+        }
+    }
+
+    if (priority == MarketData) {
+        auto it = std::find_if(queue.begin(), queue.end(), [&request](const Request& queued) {
+            return queued.method == request.method && queued.params == request.params;
+        });
+        if (it != queue.end()) {
+            for (auto& callback : request.callbacks) {
+                it->callbacks.push_back(std::move(callback));
+            }
+            ++m_stats.merged;
+            return dropped;
+        }
+    }
+
+    queue.push_back(std::move(request));
+    return dropped;
+}
+
+void RateLimitScheduler::retry(Request request) {
+    m_queues[classify(request.method)].push_front(std::move(request));
+}
+
+bool RateLimitScheduler::next(Request& out, Clock::time_point now) {
+    m_matching.refill(now);
+    m_nonMatching.refill(now);
+
+    for (auto& queue : m_queues) {
+        if (queue.empty()) {
+            continue;
+        }
+        Bucket& bucket = bucketFor(queue.front().method);
+        if (bucket.credits < bucket.limits.cost) {
+            continue;
+        }
+        bucket.credits -= bucket.limits.cost;
+        out = std::move(queue.front());
+        queue.pop_front();
+        ++m_stats.sent;
+        return true;
+    }
+    return false;
+}
+
+RateLimitScheduler::Clock::duration RateLimitScheduler::waitTime(Clock::time_point now) {
+    m_matching.refill(now);
+    m_nonMatching.refill(now);
+
+    Clock::duration wait = Clock::duration::max();
+    for (const auto& queue : m_queues) {
+        if (queue.empty()) {
+            continue;
+        }
+        const Bucket& bucket = bucketFor(queue.front().method);
+        double missing = bucket.limits.cost - bucket.credits;
+        if (missing <= 0) {
+            return Clock::duration::zero();
+        }
+        auto needed = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / bucket.limits.refillPerSecond));
+        wait = std::min(wait, needed);
+    }
+    return wait;
+}
+
+void RateLimitScheduler::onRateLimited(const std::string& method, Clock::time_point now) {
+    Bucket& bucket = bucketFor(method);
+    bucket.refill(now);
+    bucket.credits = 0;
+    ++m_stats.rateLimited;
+}
+
+std::vector<RateLimitScheduler::ResponseCallback> RateLimitScheduler::discardOrderFlow() {
+    std::vector<ResponseCallback> dropped;
+    for (Priority priority : {Modify, New}) {
+        for (auto& request : m_queues[priority]) {
+            for (auto& callback : request.callbacks) {
+                dropped.push_back(std::move(callback));
+            }
+            ++m_stats.dropped;
+        }
+        m_queues[priority].clear();
+    }
+    return dropped;
+}
+
+std::vector<RateLimitScheduler::Request> RateLimitScheduler::drain() {
+    std::vector<Request> drained;
+    for (auto& queue : m_queues) {
+        for (auto& request : queue) {
+            drained.push_back(std::move(request));
+        }
+        queue.clear();
+    }
+    return drained;
+}
+
+bool RateLimitScheduler::empty() const {
+    for (const auto& queue : m_queues) {
+        if (!queue.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RateLimitScheduler::Stats RateLimitScheduler::stats(Clock::time_point now) {
+    m_matching.refill(now);
+    m_nonMatching.refill(now);
+
+    Stats stats = m_stats;
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        stats.queued[i] = m_queues[i].size();
+    }
+    stats.matchingUtilization = 1.0 - m_matching.credits / m_matching.limits.maxCredits;
+    stats.nonMatchingUtilization = 1.0 - m_nonMatching.credits / m_nonMatching.limits.maxCredits;
+    return stats;
+}
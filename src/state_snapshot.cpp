@@ -0,0 +1,341 @@
+#include "state_snapshot.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    constexpr char kMagic[8] = {'O', 'E', 'M', 'S', 'S', 'N', 'A', 'P'};
+    constexpr uint32_t kByteOrderMark = 0x01020304;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        int64_t writtenAtMs;
+        uint64_t payloadSize;
+        uint64_t checksum;
+    };
+
+    uint64_t fnv1a(const char* data, size_t size) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // The snapshot file is written through a raw descriptor: it is created owner-only from
+    // the start and synced before the rename. POSIX and MSVC only differ in the names.
+    int createOwnerOnly(const std::string& path) {
+#ifdef _WIN32
+        return ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+#endif
+    }
+
+    bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            unsigned chunk = static_cast<unsigned>(std::min<size_t>(size, 1u << 30));
+#ifdef _WIN32
+            int written = ::_write(fd, data, chunk);
+#else
+            ssize_t written = ::write(fd, data, chunk);
+#endif
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    bool syncAndClose(int fd) {
+#ifdef _WIN32
+        bool synced = ::_commit(fd) == 0;
+        return ::_close(fd) == 0 && synced;
+#else
+        bool synced = ::fsync(fd) == 0;
+        return ::close(fd) == 0 && synced;
+#endif
+    }
+
+    template <typename T>
+    void put(std::string& out, T value) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are plain values");
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void putString(std::string& out, const std::string& value) {
+        put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    void putLevels(std::string& out, const std::vector<StateSnapshot::Level>& levels) {
+        put<uint32_t>(out, static_cast<uint32_t>(levels.size()));
+        for (const auto& level : levels) {
+            put(out, level.price);
+            put(out, level.amount);
+        }
+    }
+
+    // Bounds-checked cursor over the mapped payload; any overrun poisons the whole read
+    struct Reader {
+        const char* cursor;
+        const char* end;
+        bool ok = true;
+
+        template <typename T>
+        T get() {
+            T value{};
+            if (!ok || static_cast<size_t>(end - cursor) < sizeof(T)) {
+                ok = false;
+                return value;
+            }
+            std::memcpy(&value, cursor, sizeof(T));
+            cursor += sizeof(T);
+            return value;
+        }
+
+        std::string getString() {
+            uint32_t size = get<uint32_t>();
+            if (!ok || static_cast<size_t>(end - cursor) < size) {
+                ok = false;
+                return "";
+            }
+            std::string value(cursor, size);
+            cursor += size;
+            return value;
+        }
+
+        // Counts are checked against the bytes left so a corrupt count cannot trigger a huge reserve
+        uint32_t getCount(size_t minRecordSize) {
+            uint32_t count = get<uint32_t>();
+            if (ok && count > static_cast<size_t>(end - cursor) / minRecordSize) {
+                ok = false;
+                return 0;
+            }
+            return count;
+        }
+
+        std::vector<StateSnapshot::Level> getLevels() {
+            std::vector<StateSnapshot::Level> levels(getCount(2 * sizeof(double)));
+            for (auto& level : levels) {
+                level.price = get<double>();
+                level.amount = get<double>();
+            }
+            return levels;
+        }
+    };
+}
+
+bool StateSnapshot::write(const std::string& path, const State& state) {
+    std::string payload;
+    put<uint32_t>(payload, static_cast<uint32_t>(state.instruments.size()));
+    for (const auto& instrument : state.instruments) {
+        putString(payload, instrument.name);
+        putString(payload, instrument.kind);
+    }
+    put<uint32_t>(payload, static_cast<uint32_t>(state.books.size()));
+    for (const auto& book : state.books) {
+        putString(payload, book.instrument);
+        put(payload, book.changeId);
+        put(payload, book.timestampMs);
+        putLevels(payload, book.bids);
+        putLevels(payload, book.asks);
+    }
+    put<uint32_t>(payload, static_cast<uint32_t>(state.orders.size()));
+    for (const auto& order : state.orders) {
+        putString(payload, order.orderId);
+        putString(payload, order.instrument);
+        putString(payload, order.direction);
+        put(payload, order.price);
+        put(payload, order.amount);
+        put(payload, order.session);
+    }
+    put<uint32_t>(payload, static_cast<uint32_t>(state.positions.size()));
+    for (const auto& position : state.positions) {
+        putString(payload, position.instrument);
+        put(payload, position.size);
+        put(payload, position.averagePrice);
+    }
+    put<uint32_t>(payload, static_cast<uint32_t>(state.tokenExpiries.size()));
+    for (const auto& token : state.tokenExpiries) {
+        putString(payload, token.clientId);
+        put(payload, token.expiresAtMs);
+    }
+
+    Header header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrderMark;
+    header.writtenAtMs = state.writtenAtMs;
+    header.payloadSize = payload.size();
+    header.checksum = fnv1a(payload.data(), payload.size());
+
+    std::string temporary = path + ".tmp";
+    std::remove(temporary.c_str()); // left over from a crash mid-write
+    int fd = createOwnerOnly(temporary);
+    if (fd < 0) {
+        return false;
+    }
+    bool written = writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+    if (!syncAndClose(fd) || !written) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    return !ec;
+}
+
+bool StateSnapshot::load(const std::string& path, State& state) {
+    try
+    {
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec) || std::filesystem::file_size(path, ec) < sizeof(Header)) {
+            return false;
+        }
+
+        boost::interprocess::file_mapping file(path.c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+        const char* base = static_cast<const char*>(region.get_address());
+
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+            header.byteOrder != kByteOrderMark || header.payloadSize != region.get_size() - sizeof(Header)) {
+            return false;
+        }
+        const char* payload = base + sizeof(Header);
+        if (fnv1a(payload, header.payloadSize) != header.checksum) {
+            return false;
+        }
+
+        Reader reader{payload, payload + header.payloadSize};
+        State loaded;
+        loaded.writtenAtMs = header.writtenAtMs;
+
+        loaded.instruments.resize(reader.getCount(2 * sizeof(uint32_t)));
+        for (auto& instrument : loaded.instruments) {
+            instrument.name = reader.getString();
+            instrument.kind = reader.getString();
+        }
+        loaded.books.resize(reader.getCount(sizeof(uint32_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t)));
+        for (auto& book : loaded.books) {
+            book.instrument = reader.getString();
+            book.changeId = reader.get<int64_t>();
+            book.timestampMs = reader.get<int64_t>();
+            book.bids = reader.getLevels();
+            book.asks = reader.getLevels();
+        }
+        loaded.orders.resize(reader.getCount(3 * sizeof(uint32_t) + 2 * sizeof(double) + sizeof(uint32_t)));
+        for (auto& order : loaded.orders) {
+            order.orderId = reader.getString();
+            order.instrument = reader.getString();
+            order.direction = reader.getString();
+            order.price = reader.get<double>();
+            order.amount = reader.get<double>();
+            order.session = reader.get<uint32_t>();
+        }
+        loaded.positions.resize(reader.getCount(sizeof(uint32_t) + 2 * sizeof(double)));
+        for (auto& position : loaded.positions) {
+            position.instrument = reader.getString();
+            position.size = reader.get<double>();
+            position.averagePrice = reader.get<double>();
+        }
+        loaded.tokenExpiries.resize(reader.getCount(sizeof(uint32_t) + sizeof(int64_t)));
+        for (auto& token : loaded.tokenExpiries) {
+            token.clientId = reader.getString();
+            token.expiresAtMs = reader.get<int64_t>();
+        }
+
+        if (!reader.ok || reader.cursor != reader.end) {
+            return false;
+        }
+        state = std::move(loaded);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error while loading state snapshot: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+StateSnapshot::StateSnapshot(const std::string& path, std::chrono::milliseconds interval)
+    : m_path(path), m_interval(interval), m_running(false), m_writes(0), m_lastWriteMicros(0), m_lastSizeBytes(0) {}
+
+StateSnapshot::~StateSnapshot() {
+    stop();
+}
+
+void StateSnapshot::start(Collector collector) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+    m_collector = std::move(collector);
+    m_running = true;
+    m_worker = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_running) {
+            m_cv.wait_for(lock, m_interval, [this]() { return !m_running; });
+            if (!m_running) {
+                break;
+            }
+            lock.unlock();
+            writeNow();
+            lock.lock();
+        }
+    });
+}
+
+void StateSnapshot::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+    writeNow();
+}
+
+void StateSnapshot::writeNow() {
+    auto start = std::chrono::steady_clock::now();
+    State state;
+    state.writtenAtMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    m_collector(state);
+    if (!write(m_path, state)) {
+        std::cerr << "Failed to write state snapshot to " << m_path << std::endl;
+        return;
+    }
+
+    std::error_code ec;
+    auto size = std::filesystem::file_size(m_path, ec);
+    m_lastSizeBytes = ec ? 0 : static_cast<size_t>(size);
+    m_lastWriteMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    ++m_writes;
+}
@@ -0,0 +1,260 @@
+#include "subscription_registry.hpp"
+
+SubscriptionRegistry::SymbolId SubscriptionRegistry::intern(const std::string& symbol, const std::string& kind) {
+    auto it = m_symbolIds.find(symbol);
+    if (it != m_symbolIds.end()) {
+        SymbolId id = it->second;
+        if (!kind.empty() && m_kinds[id].empty()) {
+            // No pattern could match this symbol before its kind was known
+            m_kinds[id] = kind;
+            for (auto& [key, entry] : m_patterns) {
+                if (patternMatches(entry, id)) {
+                    entry.matches.push_back(id);
+                    for (Connection* owner : entry.owners) {
+                        addRef(*owner, id);
+                    }
+                }
+            }
+        }
+        return id;
+    }
+
+    SymbolId id = static_cast<SymbolId>(m_symbols.size());
+    m_symbolIds.emplace(symbol, id);
+    m_symbols.push_back(symbol);
+    m_kinds.push_back(kind);
+    m_subscribers.emplace_back();
+    m_owners.emplace_back();
+
+    for (auto& [key, entry] : m_patterns) {
+        if (patternMatches(entry, id)) {
+            entry.matches.push_back(id);
+            for (Connection* owner : entry.owners) {
+                addRef(*owner, id);
+            }
+        }
+    }
+    return id;
+}
+
+SubscriptionRegistry::SymbolId SubscriptionRegistry::find(const std::string& symbol) const {
+    auto it = m_symbolIds.find(symbol);
+    return it == m_symbolIds.end() ? kInvalidSymbol : it->second;
+}
+
+const std::string& SubscriptionRegistry::symbolName(SymbolId id) const {
+    static const std::string empty;
+    return id < m_symbols.size() ? m_symbols[id] : empty;
+}
+
+const std::string& SubscriptionRegistry::symbolKind(SymbolId id) const {
+    static const std::string empty;
+    return id < m_kinds.size() ? m_kinds[id] : empty;
+}
+
+bool SubscriptionRegistry::subscribe(websocketpp::connection_hdl hdl, const std::string& symbol) {
+    SymbolId id = intern(symbol);
+    Connection& conn = connectionFor(hdl);
+
+    auto it = conn.symbols.find(id);
+    if (it != conn.symbols.end()) {
+        if (it->second.direct) {
+            return false;
+        }
+        it->second.direct = true;
+        ++it->second.refs;
+        return true;
+    }
+
+    addRef(conn, id);
+    conn.symbols[id].direct = true;
+    return true;
+}
+
+bool SubscriptionRegistry::unsubscribe(websocketpp::connection_hdl hdl, const std::string& symbol) {
+    SymbolId id = find(symbol);
+    auto connIt = m_connections.find(hdl);
+    if (id == kInvalidSymbol || connIt == m_connections.end()) {
+        return false;
+    }
+
+    Connection& conn = connIt->second;
+    auto it = conn.symbols.find(id);
+    if (it == conn.symbols.end() || !it->second.direct) {
+        return false;
+    }
+
+    it->second.direct = false;
+    release(conn, id);
+    dropIfIdle(conn);
+    return true;
+}
+
+size_t SubscriptionRegistry::subscribePattern(websocketpp::connection_hdl hdl, const std::string& pattern, const std::string& kind) {
+    auto [it, inserted] = m_patterns.try_emplace({pattern, kind});
+    PatternEntry& entry = it->second;
+    if (inserted) {
+        entry.glob = pattern;
+        entry.kind = kind;
+        for (SymbolId id = 0; id < m_symbols.size(); ++id) {
+            if (patternMatches(entry, id)) {
+                entry.matches.push_back(id);
+            }
+        }
+    }
+
+    Connection& conn = connectionFor(hdl);
+    if (entry.owners.insert(&conn).second) {
+        conn.patterns.push_back(&entry);
+        for (SymbolId id : entry.matches) {
+            addRef(conn, id);
+        }
+    }
+    return entry.matches.size();
+}
+
+bool SubscriptionRegistry::unsubscribePattern(websocketpp::connection_hdl hdl, const std::string& pattern, const std::string& kind) {
+    auto patternIt = m_patterns.find({pattern, kind});
+    auto connIt = m_connections.find(hdl);
+    if (patternIt == m_patterns.end() || connIt == m_connections.end()) {
+        return false;
+    }
+
+    PatternEntry& entry = patternIt->second;
+    Connection& conn = connIt->second;
+    if (entry.owners.erase(&conn) == 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < conn.patterns.size(); ++i) {
+        if (conn.patterns[i] == &entry) {
+            conn.patterns[i] = conn.patterns.back();
+            conn.patterns.pop_back();
+            break;
+        }
+    }
+    for (SymbolId id : entry.matches) {
+        release(conn, id);
+    }
+    if (entry.owners.empty()) {
+        m_patterns.erase(patternIt);
+    }
+    dropIfIdle(conn);
+    return true;
+}
+
+void SubscriptionRegistry::removeConnection(websocketpp::connection_hdl hdl) {
+    auto connIt = m_connections.find(hdl);
+    if (connIt == m_connections.end()) {
+        return;
+    }
+
+    Connection& conn = connIt->second;
+    for (const auto& [id, membership] : conn.symbols) {
+        detach(id, membership.slot);
+    }
+    for (PatternEntry* entry : conn.patterns) {
+        entry->owners.erase(&conn);
+        if (entry->owners.empty()) {
+            m_patterns.erase({entry->glob, entry->kind});
+        }
+    }
+    m_connections.erase(connIt);
+}
+
+const std::vector<websocketpp::connection_hdl>& SubscriptionRegistry::subscribers(SymbolId id) const {
+    static const std::vector<websocketpp::connection_hdl> empty;
+    return id < m_subscribers.size() ? m_subscribers[id] : empty;
+}
+
+std::vector<SubscriptionRegistry::SymbolId> SubscriptionRegistry::activeSymbols() const {
+    std::vector<SymbolId> active;
+    for (SymbolId id = 0; id < m_subscribers.size(); ++id) {
+        if (!m_subscribers[id].empty()) {
+            active.push_back(id);
+        }
+    }
+    return active;
+}
+
+bool SubscriptionRegistry::matchesPattern(const std::string& pattern, const std::string& symbol) {
+    size_t p = 0, s = 0;
+    size_t starP = std::string::npos, starS = 0;
+    while (s < symbol.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == symbol[s])) {
+            ++p;
+            ++s;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starS = s;
+        } else if (starP != std::string::npos) {
+            p = starP + 1;
+            s = ++starS;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+SubscriptionRegistry::Connection& SubscriptionRegistry::connectionFor(websocketpp::connection_hdl hdl) {
+    auto [it, inserted] = m_connections.try_emplace(hdl);
+    if (inserted) {
+        it->second.hdl = hdl;
+    }
+    return it->second;
+}
+
+// Symbols without a kind (depth views, greeks feeds) exist only while someone subscribes
+// to them by name, so a pattern never picks them up and keeps them alive
+bool SubscriptionRegistry::patternMatches(const PatternEntry& entry, SymbolId id) const {
+    return !m_kinds[id].empty() && (entry.kind.empty() || entry.kind == m_kinds[id]) && matchesPattern(entry.glob, m_symbols[id]);
+}
+
+void SubscriptionRegistry::addRef(Connection& conn, SymbolId id) {
+    auto it = conn.symbols.find(id);
+    if (it != conn.symbols.end()) {
+        ++it->second.refs;
+        return;
+    }
+
+    uint32_t slot = static_cast<uint32_t>(m_subscribers[id].size());
+    m_subscribers[id].push_back(conn.hdl);
+    m_owners[id].push_back(&conn);
+    conn.symbols.emplace(id, Membership{slot, 1, false});
+    ++m_generation;
+}
+
+void SubscriptionRegistry::release(Connection& conn, SymbolId id) {
+    auto it = conn.symbols.find(id);
+    if (it == conn.symbols.end() || --it->second.refs > 0) {
+        return;
+    }
+    detach(id, it->second.slot);
+    conn.symbols.erase(it);
+}
+
+void SubscriptionRegistry::detach(SymbolId id, uint32_t slot) {
+    // Swap-remove keeps the subscriber vector dense; fix up the moved entry's slot
+    auto& subs = m_subscribers[id];
+    auto& owners = m_owners[id];
+    uint32_t last = static_cast<uint32_t>(subs.size() - 1);
+    if (slot != last) {
+        subs[slot] = std::move(subs[last]);
+        owners[slot] = owners[last];
+        owners[slot]->symbols[id].slot = slot;
+    }
+    subs.pop_back();
+    owners.pop_back();
+    ++m_generation;
+}
+
+void SubscriptionRegistry::dropIfIdle(Connection& conn) {
+    if (conn.symbols.empty() && conn.patterns.empty()) {
+        websocketpp::connection_hdl hdl = conn.hdl;
+        m_connections.erase(hdl);
+    }
+}
@@ -1,6 +1,11 @@
 #include "utils.hpp"
 #include "config.hpp"
 #include <curl/curl.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <rapidjson/document.h>
 
@@ -86,32 +91,86 @@ namespace UtilityNamespace {
         return readBuffer;
     }
 
-    std::string sendGetRequest(const std::string& url) {
-        CURL* curl;
-        CURLcode res;
-        std::string readBuffer;
+    namespace {
+        // One GET handle per thread, kept for the thread's lifetime so its connection
+        // (and TLS session) is reused and its buffers are not rebuilt per request
+        struct GetHandle {
+            CURL* easy;
+            curl_slist* headers;
+
+            GetHandle() {
+                curl_global_init(CURL_GLOBAL_DEFAULT);
+                easy = curl_easy_init();
+                headers = curl_slist_append(nullptr, "Accept: application/json");
+            }
+            ~GetHandle() {
+                curl_slist_free_all(headers);
+                curl_easy_cleanup(easy);
+                curl_global_cleanup();
+            }
+        };
+    }
 
-        curl_global_init(CURL_GLOBAL_DEFAULT);
-        curl = curl_easy_init();
+    bool fetchInto(const std::string& url, std::string& out) {
+        thread_local GetHandle handle;
+        out.clear();
+        if (!handle.easy) {
+            return false;
+        }
 
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle.easy, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle.easy, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(handle.easy, CURLOPT_HTTPHEADER, handle.headers);
+        curl_easy_setopt(handle.easy, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(handle.easy, CURLOPT_WRITEDATA, &out);
 
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+        CURLcode res = curl_easy_perform(handle.easy);
+        if (res != CURLE_OK) {
+            std::cerr << "cURL Error: " << curl_easy_strerror(res) << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-            res = curl_easy_perform(curl);
+    std::string sendGetRequest(const std::string& url) {
+        std::string readBuffer;
+        fetchInto(url, readBuffer);
+        return readBuffer;
+    }
 
-            if (res != CURLE_OK) {
-                std::cerr << "cURL Error: " << curl_easy_strerror(res) << std::endl;
-            }
+    std::string exchangeBaseUrl() {
+        const char* url = std::getenv("OEMS_EXCHANGE_URL");
+        return url ? url : "https://test.deribit.com/api/v2";
+    }
 
-            curl_easy_cleanup(curl);
+    // Unreserved characters (RFC 3986) pass through; everything else is %XX
+    std::string urlEncode(const std::string& value) {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string out;
+        out.reserve(value.size());
+        for (unsigned char c : value) {
+            if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+                out.push_back(static_cast<char>(c));
+            } else {
+                out.push_back('%');
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xf]);
+            }
         }
+        return out;
+    }
 
-        curl_global_cleanup();
+    void appendNumber(std::string& out, int64_t value) {
+        char digits[24];
+        char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        out.append(digits, end);
+    }
 
-        return readBuffer;
+    // Same text as std::to_string(double)
+    void appendNumber(std::string& out, double value) {
+        char digits[64];
+        int length = std::snprintf(digits, sizeof(digits), "%f", value);
+        out.append(digits, length > 0 ? std::min<size_t>(static_cast<size_t>(length), sizeof(digits) - 1) : 0);
     }
 
     void logMessage(const std::string& message) {
@@ -1,21 +1,19 @@
 #include "websocket_handler.hpp"
 #include "utils.hpp"
+#include "order_manager.hpp"
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <chrono>
-#include <curl/curl.h>
 #include <sstream>
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* s) {
-    size_t newLength = size * nmemb;
-    s->append((char*)contents, newLength);
-    return newLength;
-}
+WebSocketHandler::WebSocketHandler() : WebSocketHandler(UtilityNamespace::exchangeBaseUrl()) {}
 
-WebSocketHandler::WebSocketHandler() : m_running(false) {
+WebSocketHandler::WebSocketHandler(const std::string& baseUrl)
+    : m_baseUrl(baseUrl), m_instrumentsLoaded(false), m_bootTime(std::chrono::steady_clock::now()), m_firstValidQuoteMicros(-1), m_running(false), m_orderGateway(nullptr), m_gatewayGuard(std::make_shared<GatewayGuard>()) {
     m_server.init_asio();
 
     m_server.set_message_handler([this](connection_hdl hdl, server::message_ptr msg) {
@@ -23,15 +21,24 @@ WebSocketHandler::WebSocketHandler() : m_running(false) {
     });
 
     m_server.set_open_handler([this](connection_hdl hdl) {
+        m_latency.addConnection(hdl);
         std::cout << "New client connected.\n";
     });
 
+    m_server.set_pong_handler([this](connection_hdl hdl, std::string payload) {
+        m_latency.onPong(hdl, payload);
+    });
+
     m_server.set_close_handler([this](connection_hdl hdl) {
         handleClose(hdl);
     });
 }
 
 WebSocketHandler::~WebSocketHandler() {
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayGuard->mutex);
+        m_gatewayGuard->alive = false;
+    }
     stopServer(); 
 }
 
@@ -46,6 +53,18 @@ void WebSocketHandler::stopServer() {
     if (m_serverThread.joinable()) {
         m_serverThread.join();
     }
+    {
+        std::lock_guard<std::mutex> lock(m_catalogMutex);
+        m_catalogWake.notify_all();
+    }
+    if (m_catalogThread.joinable()) {
+        m_catalogThread.join();
+    }
+    // Cancelled only once the io thread is gone; the aborted handler ends the chain on the next start
+    if (m_probeTimer) {
+        m_probeTimer->cancel();
+        m_probeTimer.reset();
+    }
 
     m_server.get_io_service().reset();
     std::cout << "Server stopped.\n";
@@ -60,6 +79,7 @@ void WebSocketHandler::startServer(uint16_t port) {
     m_server.clear_error_channels(websocketpp::log::elevel::all);
 
     m_serverThread = std::thread([this, port]() { run(port); });
+    m_catalogThread = std::thread([this]() { refreshInstruments(); });
     std::cout << "Server started on port " << port << "\n";
 }
 
@@ -67,6 +87,7 @@ void WebSocketHandler::run(uint16_t port) {
     try {
         m_server.listen(port);
         m_server.start_accept();
+        scheduleProbes();
         m_server.run();
     } catch (const std::exception& e) {
         std::cerr << "Server error: " << e.what() << "\n";
@@ -74,54 +95,109 @@ void WebSocketHandler::run(uint16_t port) {
 }
 
 void WebSocketHandler::handleMessage(connection_hdl hdl, server::message_ptr msg) {
-    // On the server side
-    auto serverReceiveTime = std::chrono::high_resolution_clock::now();
-
-    // auto startTime = std::chrono::high_resolution_clock::now();
-
     std::string payload = msg->get_payload();
-    // auto endTime = std::chrono::high_resolution_clock::now();
-    // auto propagationDelay = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
-    // std::cout << "WebSocket Message Propagation Delay: " << propagationDelay << "ms" << std::endl;
     rapidjson::Document doc;
     doc.Parse(payload.c_str());
 
-    if (doc.HasParseError() || !doc.HasMember("action")) {
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("action") || !doc["action"].IsString()) {
         m_server.send(hdl, R"({"error": "Invalid message format"})", websocketpp::frame::opcode::text);
         return;
     }
-    if (doc.HasMember("timestamp") && doc["timestamp"].IsInt64()) {
-        int64_t clientTimestamp = doc["timestamp"].GetInt64();
-        auto serverReceiveTimestamp =
-            std::chrono::duration_cast<std::chrono::milliseconds>(serverReceiveTime.time_since_epoch()).count();
-
-        int64_t propagationDelay = serverReceiveTimestamp - clientTimestamp;
-        std::cout << "WebSocket Message Propagation Delay: " << propagationDelay << "ms" << std::endl;
-    }
     std::string action = doc["action"].GetString();
+    // {"action":"subscribe","symbol":"BTC-PERPETUAL","grouping":5,"depth":10} asks for a shared
+    // aggregated depth view instead of the raw book; the symbol becomes the view's name
+    auto resolveDepthView = [&doc](std::string& symbol) {
+        if (!doc.HasMember("grouping") && !doc.HasMember("depth")) {
+            return true;
+        }
+        bool valid = (!doc.HasMember("grouping") || doc["grouping"].IsNumber()) && (!doc.HasMember("depth") || doc["depth"].IsUint());
+        double grouping = doc.HasMember("grouping") && doc["grouping"].IsNumber() ? doc["grouping"].GetDouble() : 0.0;
+        size_t depth = doc.HasMember("depth") && doc["depth"].IsUint() ? doc["depth"].GetUint() : DepthViews::kDefaultDepth;
+        return valid && DepthViews::viewName(symbol, grouping, depth, symbol);
+    };
 
-    if (action == "subscribe" && doc.HasMember("symbol")) {
+    if (action == "auth" || action == "place" || action == "modify" || action == "cancel" ||
+        action == "cancel_all" || action == "kill_switch" || action == "rearm" || action == "gateway_stats") {
+        handleGatewayMessage(hdl, action, doc);
+    } else if (action == "time_sync" || action == "delivery" || action == "latency_stats") {
+        handleLatencyMessage(hdl, action, doc);
+    } else if (action == "subscribe" && doc.HasMember("pattern") && doc["pattern"].IsString()) {
+        // e.g. {"action":"subscribe","pattern":"BTC-*"} or {"action":"subscribe","pattern":"ETH-*","kind":"option"}
+        // Instruments listed after this (or before the first load finishes) join the subscription as they are interned
+        std::string pattern = doc["pattern"].GetString();
+        std::string kind = (doc.HasMember("kind") && doc["kind"].IsString()) ? doc["kind"].GetString() : "";
+        size_t matched;
+        {
+            std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+            matched = m_subscriptions.subscribePattern(hdl, pattern, kind);
+        }
+        std::cout << "Client subscribed to pattern: " << pattern << " (" << matched << " symbols)\n";
+        m_server.send(hdl, "Subscribed to " + pattern + " (" + std::to_string(matched) + " symbols)", websocketpp::frame::opcode::text);
+    } else if (action == "unsubscribe" && doc.HasMember("pattern") && doc["pattern"].IsString()) {
+        std::string pattern = doc["pattern"].GetString();
+        std::string kind = (doc.HasMember("kind") && doc["kind"].IsString()) ? doc["kind"].GetString() : "";
+        bool removed;
+        {
+            std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+            removed = m_subscriptions.unsubscribePattern(hdl, pattern, kind);
+        }
+        if (removed) {
+            std::cout << "Client unsubscribed from pattern: " << pattern << "\n";
+            m_server.send(hdl, "Unsubscribed from " + pattern, websocketpp::frame::opcode::text);
+        } else {
+            m_server.send(hdl, "Pattern not found in subscriptions", websocketpp::frame::opcode::text);
+        }
+    } else if (action == "subscribe" && doc.HasMember("symbol") && doc["symbol"].IsString()) {
         std::string symbol = doc["symbol"].GetString();
+        if (!resolveDepthView(symbol)) {
+            m_server.send(hdl, R"({"error": "Invalid grouping or depth"})", websocketpp::frame::opcode::text);
+            return;
+        }
+        bool known;
         {
             std::lock_guard<std::mutex> lock(m_subscriptionMutex);
-            m_subscriptions[symbol].insert(hdl);
+            known = subscribable(symbol);
+            if (known) {
+                m_subscriptions.subscribe(hdl, symbol);
+            }
+        }
+        if (!known) {
+            m_server.send(hdl, m_instrumentsLoaded ? R"({"error": "Unknown instrument"})" : R"({"error": "Instrument list is still loading"})",
+                          websocketpp::frame::opcode::text);
+            return;
         }
         std::cout << "Client subscribed to: " << symbol << "\n";
         m_server.send(hdl, "Subscribed to " + symbol, websocketpp::frame::opcode::text);
-    } else if (action == "unsubscribe" && doc.HasMember("symbol")) {
+        // Don't make the client wait a broadcast tick for the first quote
+        std::string latest;
+        if (DepthViews::isView(symbol)) {
+            latest = m_depthViews.latest(symbol);
+        } else {
+            std::lock_guard<std::mutex> lock(m_bookMutex);
+            auto it = m_latestBooks.find(symbol);
+            if (it != m_latestBooks.end()) {
+                latest = it->second;
+            }
+        }
+        if (!latest.empty()) {
+            m_server.send(hdl, LatencyMonitor::stampFrame(latest, LatencyMonitor::nowMicros()), websocketpp::frame::opcode::text);
+        }
+    } else if (action == "unsubscribe" && doc.HasMember("symbol") && doc["symbol"].IsString()) {
         std::string symbol = doc["symbol"].GetString();
+        if (!resolveDepthView(symbol)) {
+            m_server.send(hdl, R"({"error": "Invalid grouping or depth"})", websocketpp::frame::opcode::text);
+            return;
+        }
+        bool removed;
         {
             std::lock_guard<std::mutex> lock(m_subscriptionMutex);
-            if (m_subscriptions.count(symbol)) {
-                m_subscriptions[symbol].erase(hdl);
-                if (m_subscriptions[symbol].empty()) {
-                    m_subscriptions.erase(symbol);
-                }
-                std::cout << "Client unsubscribed from: " << symbol << "\n";
-                m_server.send(hdl, "Unsubscribed from " + symbol, websocketpp::frame::opcode::text);
-            } else {
-                m_server.send(hdl, "Symbol not found in subscriptions", websocketpp::frame::opcode::text);
-            }
+            removed = m_subscriptions.unsubscribe(hdl, symbol);
+        }
+        if (removed) {
+            std::cout << "Client unsubscribed from: " << symbol << "\n";
+            m_server.send(hdl, "Unsubscribed from " + symbol, websocketpp::frame::opcode::text);
+        } else {
+            m_server.send(hdl, "Symbol not found in subscriptions", websocketpp::frame::opcode::text);
         }
     } else {
         m_server.send(hdl, "Unknown command", websocketpp::frame::opcode::text);
@@ -129,63 +205,746 @@ void WebSocketHandler::handleMessage(connection_hdl hdl, server::message_ptr msg
 }
 
 void WebSocketHandler::handleClose(connection_hdl hdl) {
-    std::lock_guard<std::mutex> lock(m_subscriptionMutex);
-    for (auto& [symbol, clients] : m_subscriptions) {
-        clients.erase(hdl); 
+    {
+        std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+        m_subscriptions.removeConnection(hdl);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayMutex);
+        m_gatewayClients.erase(hdl);
     }
+    m_latency.removeConnection(hdl);
     std::cout << "Client disconnected.\n";
 }
 
-std::string WebSocketHandler::getOrderBook(const std::string& symbol) {
-    CURL* curl;
-    CURLcode res;
-    std::string readBuffer;
+// Latency probing, e.g.
+// {"action":"time_sync"}   opt in; the server then sends {"type":"time_sync","id":..,"t1":..} every probe interval
+// {"action":"time_sync","id":7,"t1":..,"t2":<client receive us>,"t3":<client send us>}
+// {"action":"delivery","samples":[[<server_ts_us>,<client receive us>],...]}
+// {"action":"latency_stats"}
+void WebSocketHandler::handleLatencyMessage(connection_hdl hdl, const std::string& action, const rapidjson::Document& doc) {
+    websocketpp::lib::error_code ec;
+    if (action == "time_sync") {
+        bool isReply = doc.HasMember("id") && doc["id"].IsUint64();
+        for (const char* key : {"t1", "t2", "t3"}) {
+            isReply = isReply && doc.HasMember(key) && doc[key].IsInt64();
+        }
+        if (!isReply) {
+            m_server.send(hdl, m_latency.beginTimeSync(hdl), websocketpp::frame::opcode::text, ec);
+            return;
+        }
+
+        m_latency.onTimeSync(hdl, doc["id"].GetUint64(), doc["t1"].GetInt64(), doc["t2"].GetInt64(), doc["t3"].GetInt64());
+        // Burst until the offset filter has a full window, then fall back to the probe interval
+        LatencyMonitor::Stats stats;
+        if (m_latency.stats(hdl, stats) && stats.syncSamples < LatencyMonitor::kOffsetWindow) {
+            m_server.send(hdl, m_latency.beginTimeSync(hdl), websocketpp::frame::opcode::text, ec);
+        }
+    } else if (action == "delivery") {
+        if (doc.HasMember("samples") && doc["samples"].IsArray()) {
+            for (const auto& sample : doc["samples"].GetArray()) {
+                if (sample.IsArray() && sample.Size() == 2 && sample[0].IsInt64() && sample[1].IsInt64()) {
+                    m_latency.onDelivery(hdl, sample[0].GetInt64(), sample[1].GetInt64());
+                }
+            }
+        } else if (doc.HasMember("server_ts_us") && doc["server_ts_us"].IsInt64() &&
+                   doc.HasMember("recv_ts_us") && doc["recv_ts_us"].IsInt64()) {
+            m_latency.onDelivery(hdl, doc["server_ts_us"].GetInt64(), doc["recv_ts_us"].GetInt64());
+        }
+    } else {
+        std::string report = m_latency.report(hdl);
+        m_server.send(hdl, report.empty() ? R"({"error": "No latency data for this connection"})" : report,
+                      websocketpp::frame::opcode::text, ec);
+    }
+}
+
+// Runs on the server's io_service, so probes never wait behind the broadcast loop
+void WebSocketHandler::scheduleProbes() {
+    m_probeTimer = m_server.set_timer(kProbeIntervalMs, [this](const websocketpp::lib::error_code& ec) {
+        if (ec || !m_running) {
+            return;
+        }
+        sendProbes();
+        scheduleProbes();
+    });
+}
 
-    curl = curl_easy_init();
-    if (curl) {
-        std::string url = "https://test.deribit.com/api/v2/public/get_order_book?instrument_name=" + symbol;
+void WebSocketHandler::sendProbes() {
+    for (const auto& [hdl, timeSync] : m_latency.probeTargets()) {
+        websocketpp::lib::error_code ec;
+        m_server.ping(hdl, m_latency.beginPing(hdl), ec);
+        if (timeSync) {
+            m_server.send(hdl, m_latency.beginTimeSync(hdl), websocketpp::frame::opcode::text, ec);
+        }
+    }
+}
 
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback); 
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+void WebSocketHandler::enableOrderGateway(OrderManager& orderManager, const std::string& accessToken) {
+    std::lock_guard<std::mutex> lock(m_gatewayMutex);
+    m_orderGateway = &orderManager;
+    m_gatewayToken = accessToken;
+}
 
-        struct curl_slist* headers = nullptr;
-        headers = curl_slist_append(headers, "Accept: application/json");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+void WebSocketHandler::disableOrderGateway() {
+    std::lock_guard<std::mutex> lock(m_gatewayMutex);
+    m_orderGateway = nullptr;
+    m_gatewayToken.clear();
+    for (auto& [hdl, client] : m_gatewayClients) {
+        client.authenticated = false;
+    }
+}
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "CURL Error: " << curl_easy_strerror(res) << std::endl;
+// Order actions from local clients, e.g.
+// {"action":"place","req_id":"1","side":"buy","instrument_name":"BTC-PERPETUAL","amount":10,"price":50000,"type":"limit"}
+//     (optional "strategy":"<tag>" picks the account session under strategy routing)
+// {"action":"modify","req_id":"2","order_id":"...","amount":10,"price":50100}
+// {"action":"cancel","req_id":"3","order_id":"..."}
+// {"action":"cancel_all","req_id":"4","currency":"BTC"}   (or "instrument_name", or neither for everything)
+// {"action":"kill_switch","req_id":"5"}   (then place and modify are rejected until...)
+// {"action":"rearm","req_id":"6"}
+void WebSocketHandler::handleGatewayMessage(connection_hdl hdl, const std::string& action, const rapidjson::Document& doc) {
+    std::string reqId;
+    if (doc.HasMember("req_id") && doc["req_id"].IsString()) {
+        reqId = doc["req_id"].GetString();
+    } else if (doc.HasMember("req_id") && doc["req_id"].IsInt64()) {
+        reqId = std::to_string(doc["req_id"].GetInt64());
+    }
+
+    bool hasOrderId = doc.HasMember("order_id") && doc["order_id"].IsString();
+    bool hasPrice = doc.HasMember("amount") && doc["amount"].IsNumber() && doc.HasMember("price") && doc["price"].IsNumber();
+    std::string orderId = hasOrderId ? doc["order_id"].GetString() : "";
+
+    if (action == "gateway_stats") {
+        pruneGatewayOrders(hdl);
+    }
+
+    OrderManager* gateway = nullptr;
+    std::string error;
+    std::string reply;
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayMutex);
+        GatewayClient& client = m_gatewayClients[hdl];
+        gateway = m_orderGateway;
+
+        if (!gateway) {
+            error = "Order gateway is not enabled";
+        } else if (action == "auth") {
+            if (doc.HasMember("token") && doc["token"].IsString() && m_gatewayToken == doc["token"].GetString()) {
+                client.authenticated = true;
+                reply = R"({"type":"auth","result":"ok"})";
+            } else {
+                error = "Invalid gateway token";
+            }
+        } else if (!client.authenticated) {
+            error = "Not authenticated";
+        } else if (action == "gateway_stats") {
+            reply = "{\"type\":\"gateway_stats\",\"placed\":" + std::to_string(client.placed) +
+                    ",\"modified\":" + std::to_string(client.modified) +
+                    ",\"cancelled\":" + std::to_string(client.cancelled) +
+                    ",\"rejected\":" + std::to_string(client.rejected) +
+                    ",\"in_flight\":" + std::to_string(client.inFlight) +
+                    ",\"open_orders\":" + std::to_string(client.orders.size()) + "}";
+        } else if (action == "rearm") {
+            gateway->rearm();
+            reply = R"({"type":"rearm","result":"ok"})";
+        } else if (action == "kill_switch") {
+            // Never throttled: pulling orders must always be possible
+        } else if (client.inFlight >= kMaxClientInFlight) {
+            error = "Too many requests in flight";
+        } else if (action == "place") {
+            if (!doc.HasMember("instrument_name") || !doc["instrument_name"].IsString() || !hasPrice ||
+                !doc.HasMember("side") || !doc["side"].IsString() ||
+                (std::string(doc["side"].GetString()) != "buy" && std::string(doc["side"].GetString()) != "sell")) {
+                error = "place requires side (buy/sell), instrument_name, amount and price";
+            }
+        } else if (action == "cancel_all") {
+            // Mass cancels act on the whole account, not only this connection's orders
+        } else if (!hasOrderId || (action == "modify" && !hasPrice)) {
+            error = action + " requires order_id" + (action == "modify" ? ", amount and price" : "");
+        } else if (client.orders.count(orderId) == 0) {
+            // Clients may only touch orders they placed through this connection
+            error = "Unknown order_id for this connection";
         }
 
-        curl_easy_cleanup(curl);
-        if (headers) {
-            curl_slist_free_all(headers);
+        if (!error.empty()) {
+            ++client.rejected;
+        } else if (reply.empty()) {
+            ++client.inFlight;
         }
     }
 
-    if (!readBuffer.empty()) {
-        // Return the fetched JSON response
-        return readBuffer;
+    if (!error.empty()) {
+        sendGatewayError(hdl, reqId, error);
+        return;
+    }
+    if (!reply.empty()) {
+        m_server.send(hdl, reply, websocketpp::frame::opcode::text);
+        return;
+    }
+
+    auto guard = m_gatewayGuard;
+    auto callback = [this, guard, hdl, action, reqId](bool ok, const std::string& response) {
+        std::lock_guard<std::mutex> lock(guard->mutex);
+        if (guard->alive) {
+            handleGatewayResponse(hdl, action, reqId, ok, response);
+        }
+    };
+
+    if (action == "kill_switch") {
+        gateway->triggerKillSwitch([this, guard, hdl, reqId](const OrderManager::KillSwitchReport& report) {
+            std::lock_guard<std::mutex> lock(guard->mutex);
+            if (guard->alive) {
+                handleKillSwitchReport(hdl, reqId, report);
+            }
+        });
+    } else if (action == "cancel_all") {
+        std::string currency = (doc.HasMember("currency") && doc["currency"].IsString()) ? doc["currency"].GetString() : "";
+        std::string instrument = (doc.HasMember("instrument_name") && doc["instrument_name"].IsString()) ? doc["instrument_name"].GetString() : "";
+        gateway->cancelAllAsync(currency, instrument, callback);
+    } else if (action == "place") {
+        std::string orderType = (doc.HasMember("type") && doc["type"].IsString()) ? doc["type"].GetString() : "limit";
+        std::string strategy = (doc.HasMember("strategy") && doc["strategy"].IsString()) ? doc["strategy"].GetString() : "";
+        gateway->placeOrderAsync(doc["instrument_name"].GetString(), doc["side"].GetString(),
+                                 doc["amount"].GetDouble(), doc["price"].GetDouble(), orderType, callback, strategy);
+    } else if (action == "modify") {
+        gateway->modifyOrderAsync(orderId, doc["amount"].GetDouble(), doc["price"].GetDouble(), callback);
     } else {
-        // Return an error response in case of failure
-        return R"({"error": "Failed to fetch order book"})";
+        gateway->cancelOrderAsync(orderId, callback);
     }
 }
 
-void WebSocketHandler::broadcastOrderBookUpdates(std::atomic<bool>& isBroadcasting) {
-    while (m_running && isBroadcasting) {
+// Runs on the exchange session worker: update accounting and route the ack
+// (and any fills carried in the response) back to the originating connection.
+void WebSocketHandler::handleGatewayResponse(connection_hdl hdl, const std::string& action, const std::string& reqId, bool ok, const std::string& response) {
+    rapidjson::Document doc;
+    doc.Parse(response.c_str());
+    bool parsed = !doc.HasParseError() && doc.IsObject();
+    bool accepted = ok && parsed && doc.HasMember("result") && !doc.HasMember("error");
+
+    std::string orderId;
+    bool open = true;
+    if (accepted) {
+        const auto& result = doc["result"];
+        if (result.IsObject() && result.HasMember("order") && result["order"].IsObject() && result["order"].HasMember("order_id") &&
+            result["order"]["order_id"].IsString()) {
+            const auto& order = result["order"];
+            orderId = order["order_id"].GetString();
+            // Filled, cancelled and rejected orders leave the connection's open set
+            if (order.HasMember("order_state") && order["order_state"].IsString()) {
+                std::string state = order["order_state"].GetString();
+                open = state == "open" || state == "untriggered";
+            }
+        } else if (result.IsObject() && result.HasMember("order_id") && result["order_id"].IsString()) {
+            orderId = result["order_id"].GetString();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayMutex);
+        auto it = m_gatewayClients.find(hdl);
+        if (it != m_gatewayClients.end()) {
+            GatewayClient& client = it->second;
+            --client.inFlight;
+            if (!accepted) {
+                ++client.rejected;
+            } else if (action == "place") {
+                ++client.placed;
+                if (open) {
+                    client.orders.insert(orderId);
+                }
+            } else if (action == "modify") {
+                ++client.modified;
+                if (!open) {
+                    client.orders.erase(orderId);
+                }
+            } else {
+                ++client.cancelled;
+                client.orders.erase(orderId);
+            }
+        }
+    }
+    if (accepted && action == "cancel_all") {
+        // The order manager has already forgotten what the mass cancel removed
+        pruneGatewayOrders(hdl);
+    }
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("order_ack");
+    writer.Key("action");
+    writer.String(action.c_str());
+    writer.Key("req_id");
+    writer.String(reqId.c_str());
+    writer.Key("ok");
+    writer.Bool(accepted);
+    writer.Key("response");
+    if (parsed) {
+        writer.RawValue(response.c_str(), response.size(), rapidjson::kObjectType);
+    } else {
+        writer.String(response.c_str());
+    }
+    writer.EndObject();
+
+    websocketpp::lib::error_code ec;
+    m_server.send(hdl, buffer.GetString(), buffer.GetSize(), websocketpp::frame::opcode::text, ec);
+
+    if (accepted && doc["result"].HasMember("trades") && doc["result"]["trades"].IsArray() && !doc["result"]["trades"].Empty()) {
+        buffer.Clear();
+        writer.Reset(buffer);
+        writer.StartObject();
+        writer.Key("type");
+        writer.String("fill");
+        writer.Key("req_id");
+        writer.String(reqId.c_str());
+        writer.Key("order_id");
+        writer.String(orderId.c_str());
+        writer.Key("trades");
+        doc["result"]["trades"].Accept(writer);
+        writer.EndObject();
+        m_server.send(hdl, buffer.GetString(), buffer.GetSize(), websocketpp::frame::opcode::text, ec);
+    }
+}
+
+// Drops ids the order manager no longer tracks (mass cancels, fills seen on reconcile).
+// Its lock is never taken under m_gatewayMutex, so the two components never nest locks.
+void WebSocketHandler::pruneGatewayOrders(connection_hdl hdl) {
+    OrderManager* gateway;
+    std::vector<std::string> orders;
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayMutex);
+        auto it = m_gatewayClients.find(hdl);
+        gateway = m_orderGateway;
+        if (!gateway || it == m_gatewayClients.end()) {
+            return;
+        }
+        orders.assign(it->second.orders.begin(), it->second.orders.end());
+    }
+
+    std::vector<std::string> closed;
+    for (const auto& order : orders) {
+        if (!gateway->tracksOrder(order)) {
+            closed.push_back(order);
+        }
+    }
+    if (closed.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_gatewayMutex);
+    auto it = m_gatewayClients.find(hdl);
+    if (it != m_gatewayClients.end()) {
+        for (const auto& order : closed) {
+            it->second.orders.erase(order);
+        }
+    }
+}
+
+void WebSocketHandler::handleKillSwitchReport(connection_hdl hdl, const std::string& reqId, const OrderManager::KillSwitchReport& report) {
+    {
+        std::lock_guard<std::mutex> lock(m_gatewayMutex);
+        for (auto& [client, state] : m_gatewayClients) {
+            if (report.flat) {
+                state.orders.clear();
+            }
+            if (client.lock() == hdl.lock()) {
+                --state.inFlight;
+            }
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("kill_switch");
+    writer.Key("req_id");
+    writer.String(reqId.c_str());
+    writer.Key("ok");
+    writer.Bool(report.ok);
+    writer.Key("flat");
+    writer.Bool(report.flat);
+    writer.Key("cancelled");
+    writer.Uint64(report.cancelled);
+    writer.Key("ack_us");
+    writer.Int64(report.ackMicros);
+    writer.Key("flat_us");
+    writer.Int64(report.flatMicros);
+    if (!report.error.empty()) {
+        writer.Key("error");
+        writer.String(report.error.c_str());
+    }
+    writer.EndObject();
+
+    websocketpp::lib::error_code ec;
+    m_server.send(hdl, buffer.GetString(), buffer.GetSize(), websocketpp::frame::opcode::text, ec);
+}
+
+void WebSocketHandler::sendGatewayError(connection_hdl hdl, const std::string& reqId, const std::string& error) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("type");
+    writer.String("order_reject");
+    writer.Key("req_id");
+    writer.String(reqId.c_str());
+    writer.Key("error");
+    writer.String(error.c_str());
+    writer.EndObject();
+    m_server.send(hdl, buffer.GetString(), websocketpp::frame::opcode::text);
+}
+
+// Runs while the server does, off the io thread: the instrument list backs pattern
+// subscriptions and symbol validation, and a blocking fetch there would stall every connection.
+void WebSocketHandler::refreshInstruments() {
+    std::unique_lock<std::mutex> lock(m_catalogMutex);
+    while (m_running) {
+        lock.unlock();
+        bool loaded = loadInstruments();
+        lock.lock();
+        m_catalogWake.wait_for(lock, std::chrono::seconds(loaded ? kCatalogRefreshSeconds : kCatalogRetrySeconds), [this]() { return !m_running; });
+    }
+}
+
+// Adds instruments listed since the last load; ones already known keep their ids.
+bool WebSocketHandler::loadInstruments() {
+    std::string response = UtilityNamespace::sendGetRequest(m_baseUrl + "/public/get_instruments?currency=any");
+    rapidjson::Document doc;
+    doc.Parse(response.c_str());
+    if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray()) {
+        std::cerr << "Failed to load the instrument list.\n";
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+    for (const auto& instrument : doc["result"].GetArray()) {
+        if (instrument.IsObject() && instrument.HasMember("instrument_name") && instrument.HasMember("kind")) {
+            if (instrument["instrument_name"].IsString() && instrument["kind"].IsString()) {
+                internInstrument(instrument["instrument_name"].GetString(), instrument["kind"].GetString());
+            }
+        }
+    }
+    m_instrumentsLoaded = true;
+    return true;
+}
+
+void WebSocketHandler::internInstrument(const std::string& name, const std::string& kind) {
+    m_subscriptions.intern(name, kind);
+    if (kind == "option") {
+        m_optionCurrencies.insert(name.substr(0, name.find('-')));
+    }
+}
+
+// Plain symbols and the instruments of depth views must be listed, and greeks feeds must
+// name a currency with listed options, so clients cannot grow the registry (or the
+// exchange requests) at will
+bool WebSocketHandler::subscribable(const std::string& symbol) const {
+    std::string instrument = symbol;
+    if (DepthViews::isView(symbol) && !DepthViews::viewInstrument(symbol, instrument)) {
+        return false;
+    }
+    if (symbol.rfind("greeks.", 0) == 0) {
+        return m_optionCurrencies.count(symbol.substr(7)) != 0;
+    }
+    SubscriptionRegistry::SymbolId id = m_subscriptions.find(instrument);
+    return id != SubscriptionRegistry::kInvalidSymbol && !m_subscriptions.symbolKind(id).empty();
+}
+
+void WebSocketHandler::noteValidQuote(const std::string& symbol, const std::string& frame) {
+    {
+        std::lock_guard<std::mutex> lock(m_bookMutex);
+        m_latestBooks[symbol] = frame;
+    }
+    int64_t none = -1;
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_bootTime).count();
+    m_firstValidQuoteMicros.compare_exchange_strong(none, elapsed);
+}
+
+void WebSocketHandler::restoreState(const StateSnapshot::State* restored, std::chrono::steady_clock::time_point bootTime) {
+    m_bootTime = bootTime;
+    if (!restored) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+        for (const auto& instrument : restored->instruments) {
+            internInstrument(instrument.name, instrument.kind);
+        }
+    }
+    // The restored registry serves pattern subscriptions until reconcileState() refreshes it
+    m_instrumentsLoaded = !restored->instruments.empty();
+    m_restoredBooks = restored->books;
+
+    // Restored books are served to subscribers at once, marked "stale" until a fresh fetch replaces them
+    std::lock_guard<std::mutex> lock(m_bookMutex);
+    for (const auto& book : restored->books) {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("jsonrpc");
+        writer.String("2.0");
+        writer.Key("result");
+        writer.StartObject();
+        writer.Key("instrument_name");
+        writer.String(book.instrument.c_str());
+        writer.Key("change_id");
+        writer.Int64(book.changeId);
+        writer.Key("timestamp");
+        writer.Int64(book.timestampMs);
+        for (auto [side, levels] : {std::make_pair("bids", &book.bids), std::make_pair("asks", &book.asks)}) {
+            writer.Key(side);
+            writer.StartArray();
+            for (const auto& level : *levels) {
+                writer.StartArray();
+                writer.Double(level.price);
+                writer.Double(level.amount);
+                writer.EndArray();
+            }
+            writer.EndArray();
+        }
+        writer.Key("stale");
+        writer.Bool(true);
+        writer.EndObject();
+        writer.EndObject();
+        m_latestBooks.emplace(book.instrument, buffer.GetString());
+    }
+}
+
+void WebSocketHandler::exportState(StateSnapshot::State& state) {
+    if (m_instrumentsLoaded) {
         std::lock_guard<std::mutex> lock(m_subscriptionMutex);
-        for (const auto& [symbol, clients] : m_subscriptions) {
-            std::string orderBookData = getOrderBook(symbol);
-            for (const auto& client : clients) {
-                try {
-                    m_server.send(client, orderBookData, websocketpp::frame::opcode::text);
-                } catch (const websocketpp::exception& e) {
-                    std::cerr << "Error sending to client: " << e.what() << std::endl;
+        state.instruments.reserve(m_subscriptions.symbolCount());
+        for (SubscriptionRegistry::SymbolId id = 0; id < m_subscriptions.symbolCount(); ++id) {
+            state.instruments.push_back({m_subscriptions.symbolName(id), m_subscriptions.symbolKind(id)});
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> books;
+    {
+        std::lock_guard<std::mutex> lock(m_bookMutex);
+        books.assign(m_latestBooks.begin(), m_latestBooks.end());
+    }
+    for (const auto& [symbol, frame] : books) {
+        rapidjson::Document doc;
+        doc.Parse(frame.c_str());
+        if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsObject()) {
+            continue;
+        }
+        const auto& result = doc["result"];
+        StateSnapshot::Book book;
+        book.instrument = symbol;
+        book.changeId = (result.HasMember("change_id") && result["change_id"].IsInt64()) ? result["change_id"].GetInt64() : 0;
+        book.timestampMs = (result.HasMember("timestamp") && result["timestamp"].IsInt64()) ? result["timestamp"].GetInt64() : 0;
+        for (auto [side, levels] : {std::make_pair("bids", &book.bids), std::make_pair("asks", &book.asks)}) {
+            if (!result.HasMember(side) || !result[side].IsArray()) {
+                continue;
+            }
+            for (const auto& level : result[side].GetArray()) {
+                if (level.IsArray() && level.Size() >= 2) {
+                    levels->push_back({level[0].GetDouble(), level[1].GetDouble()});
                 }
             }
         }
+        state.books.push_back(std::move(book));
+    }
+}
+
+// REST has no book deltas, so each restored book is fetched once; its change_id tells
+// whether the book moved while we were down. Books come first: they gate the first
+// valid quote, so they are fetched by several threads at once.
+WebSocketHandler::WarmStartReport WebSocketHandler::reconcileState() {
+    WarmStartReport report;
+    std::atomic<size_t> next{0};
+    std::mutex reportMutex;
+    auto fetch = [this, &next, &report, &reportMutex]() {
+        std::string frame;
+        for (size_t i = next++; i < m_restoredBooks.size(); i = next++) {
+            const StateSnapshot::Book& restored = m_restoredBooks[i];
+            getOrderBook(restored.instrument, frame);
+            rapidjson::Document doc;
+            doc.Parse(frame.c_str());
+            bool valid = !doc.HasParseError() && doc.HasMember("result") && doc["result"].IsObject();
+            if (valid) {
+                noteValidQuote(restored.instrument, frame);
+            }
+            bool unchanged = valid && doc["result"].HasMember("change_id") && doc["result"]["change_id"].IsInt64() &&
+                             doc["result"]["change_id"].GetInt64() == restored.changeId;
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (!valid) {
+                ++report.booksFailed;
+            } else if (unchanged) {
+                ++report.booksUnchanged;
+            } else {
+                ++report.booksUpdated;
+            }
+        }
+    };
+    std::vector<std::thread> fetchers;
+    for (size_t i = 1; i < std::min(kReconcileFetchers, m_restoredBooks.size()); ++i) {
+        fetchers.emplace_back(fetch);
+    }
+    fetch();
+    for (auto& fetcher : fetchers) {
+        fetcher.join();
+    }
+    m_restoredBooks.clear();
+
+    loadInstruments();
+    {
+        std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+        report.instruments = m_subscriptions.symbolCount();
+    }
+    report.firstValidQuoteMicros = m_firstValidQuoteMicros.load();
+    return report;
+}
+
+// Fetches into the caller's buffer over this thread's kept-alive handle, so the broadcast
+// loop reuses one buffer per symbol instead of building a new string every tick
+void WebSocketHandler::getOrderBook(const std::string& symbol, std::string& out, size_t depth) {
+    thread_local std::string url;
+    url.assign(m_baseUrl).append("/public/get_order_book?instrument_name=").append(symbol);
+    if (depth > 0) {
+        url.append("&depth=");
+        UtilityNamespace::appendNumber(url, static_cast<int64_t>(depth));
+    }
+    if (!UtilityNamespace::fetchInto(url, out) || out.empty()) {
+        out.assign(R"({"error": "Failed to fetch order book"})");
+    }
+}
+
+// Chain analytics for subscribers of "greeks.<CURRENCY>": one book summary request
+// refreshes every option's mid, and only expiries whose quotes moved are re-solved.
+// The chain is reloaded as the analytics engine asks, so new expiries and strikes appear.
+std::string WebSocketHandler::getGreeks(const std::string& currency) {
+    std::string encoded = UtilityNamespace::urlEncode(currency);
+    if (m_analytics.reloadDue(currency)) {
+        std::string instruments = UtilityNamespace::sendGetRequest(
+            m_baseUrl + "/public/get_instruments?currency=" + encoded + "&kind=option&expired=false");
+        // A failed reload keeps the chain already loaded
+        if (m_analytics.loadChain(currency, instruments) == 0 && !m_analytics.hasChain(currency)) {
+            return R"({"error": "Failed to load option chain"})";
+        }
+    } else if (!m_analytics.hasChain(currency)) {
+        return R"({"error": "Failed to load option chain"})";
+    }
+
+    std::string summary = UtilityNamespace::sendGetRequest(
+        m_baseUrl + "/public/get_book_summary_by_currency?currency=" + encoded + "&kind=option");
+    m_analytics.applyBookSummary(currency, summary);
+    return m_analytics.snapshot(currency);
+}
+
+void WebSocketHandler::broadcastOrderBookUpdates(std::atomic<bool>& isBroadcasting) {
+    while (m_running && isBroadcasting) {
+        broadcastTick();
         std::this_thread::sleep_for(std::chrono::milliseconds(500)); 
     }
-}
\ No newline at end of file
+}
+
+// Called with m_subscriptionMutex held. Depth sources go first, so a view sent in
+// a tick already reflects the book fetched in that tick; views keep the version
+// their clients last got, so a subscription change does not resend unchanged views.
+void WebSocketHandler::rebuildBroadcastTargets() {
+    std::unordered_map<std::string, uint64_t> sentVersions;
+    std::vector<std::string> views;
+    for (const auto& target : m_broadcastTargets) {
+        if (DepthViews::isView(target.symbol)) {
+            sentVersions[target.symbol] = target.viewVersion;
+        }
+    }
+    m_broadcastTargets.clear();
+    for (SubscriptionRegistry::SymbolId id : m_subscriptions.activeSymbols()) {
+        if (DepthViews::isView(m_subscriptions.symbolName(id))) {
+            views.push_back(m_subscriptions.symbolName(id));
+        }
+    }
+    for (const auto& instrument : m_depthViews.retain(views)) {
+        m_broadcastTargets.push_back({instrument, {}, std::string(), true, 0});
+    }
+    for (SubscriptionRegistry::SymbolId id : m_subscriptions.activeSymbols()) {
+        const std::string& symbol = m_subscriptions.symbolName(id);
+        auto sent = sentVersions.find(symbol);
+        m_broadcastTargets.push_back({symbol, m_subscriptions.subscribers(id), std::string(), false, sent == sentVersions.end() ? 0 : sent->second,
+                                      m_subscriptions.symbolKind(id) == "option"});
+    }
+    m_broadcastGeneration = m_subscriptions.generation();
+}
+
+server::message_ptr WebSocketHandler::pooledFrame() {
+    for (const auto& frame : m_framePool) {
+        if (frame.use_count() == 1) {
+            return frame;
+        }
+    }
+    auto frame = std::make_shared<websocketpp::config::asio::message_type>(nullptr, websocketpp::frame::opcode::text);
+    if (m_framePool.size() < kMaxPooledFrames) {
+        m_framePool.push_back(frame);
+    }
+    return frame;
+}
+
+void WebSocketHandler::prepareFrame(const server::message_ptr& frame) {
+    uint64_t size = frame->get_payload().size();
+    frame->set_opcode(websocketpp::frame::opcode::text);
+    frame->set_header(websocketpp::frame::prepare_header(websocketpp::frame::basic_header(websocketpp::frame::opcode::text, size, true, false),
+                                                         websocketpp::frame::extended_header(size)));
+    frame->set_prepared(true);
+}
+
+// Subscriber lists are copied only when the registry changes, and the lock is
+// never held across the order book fetch, so connect/disconnect churn does
+// not stall the broadcast loop (and vice versa). Each target keeps its book
+// buffer, and each frame is stamped into a pooled, pre-framed message that every
+// client's connection queues as is, so a steady tick reuses memory.
+// Depth views are computed once per tick and their frame shared by all their clients.
+void WebSocketHandler::broadcastTick() {
+    {
+        std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+        if (m_subscriptions.generation() != m_broadcastGeneration) {
+            rebuildBroadcastTargets();
+        }
+    }
+
+    for (auto& target : m_broadcastTargets) {
+        if (target.depthSource) {
+            // Views only: raw subscribers of the instrument keep their own, normal-depth fetch
+            getOrderBook(target.symbol, target.book, DepthViews::kSourceLevels);
+            m_depthViews.applyBook(target.symbol, target.book);
+            continue;
+        } else if (DepthViews::isView(target.symbol)) {
+            if (!m_depthViews.frameSince(target.symbol, target.viewVersion, target.book)) {
+                continue; // visible bins unchanged since these clients' last frame
+            }
+        } else if (target.symbol.rfind("greeks.", 0) == 0) {
+            target.book = getGreeks(target.symbol.substr(7));
+        } else {
+            getOrderBook(target.symbol, target.book);
+            if (target.book.find("\"result\"") != std::string::npos) {
+                noteValidQuote(target.symbol, target.book);
+            }
+            // Option books streamed to clients also feed the analytics chain
+            if (target.option) {
+                m_analytics.applyOrderBook(target.book);
+            }
+        }
+        // One stamp per frame: fan-out lag then shows how long later clients wait behind earlier ones
+        int64_t stamp = LatencyMonitor::nowMicros();
+        server::message_ptr frame = pooledFrame();
+        LatencyMonitor::stampFrame(frame->get_raw_payload(), target.book, stamp);
+        prepareFrame(frame);
+        for (const auto& client : target.clients) {
+            websocketpp::lib::error_code ec;
+            server::connection_ptr connection = m_server.get_con_from_hdl(client, ec);
+            if (ec || !connection) {
+                continue; // already gone; the close handler drops its subscriptions
+            }
+            ec = connection->send(frame);
+            if (ec) {
+                std::cerr << "Error sending to client: " << ec.message() << std::endl;
+                continue;
+            }
+            m_latency.onFanout(client, stamp, connection->get_buffered_amount());
+        }
+    }
+}
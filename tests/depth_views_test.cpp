@@ -0,0 +1,171 @@
+#include "depth_views.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+// Aggregated depth views against hand-computed books: prices fall into the right
+// bins, cumulative sizes run from the top of the book, a book applied as a diff
+// gives the same bins as one built from scratch, and a frame is re-sent only when
+// its visible bins change.
+
+namespace {
+    int failures = 0;
+
+    struct Bin {
+        double price;
+        double size;
+        double cumulative;
+    };
+
+    void check(bool ok, const char* what, const std::string& detail = "") {
+        if (!ok) {
+            std::printf("FAIL %s %s\n", what, detail.c_str());
+            ++failures;
+        }
+    }
+
+    std::string book(int64_t changeId, const std::string& bids, const std::string& asks) {
+        return R"({"result":{"change_id":)" + std::to_string(changeId) + R"(,"timestamp":1000,"bids":)" + bids +
+               R"(,"asks":)" + asks + "}}";
+    }
+
+    std::string viewName(const std::string& instrument, double grouping, size_t depth) {
+        std::string name;
+        DepthViews::viewName(instrument, grouping, depth, name);
+        return name;
+    }
+
+    std::vector<Bin> side(const std::string& frame, const char* key) {
+        std::vector<Bin> bins;
+        rapidjson::Document doc;
+        doc.Parse(frame.c_str());
+        if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember(key) || !doc[key].IsArray()) {
+            return bins;
+        }
+        for (const auto& level : doc[key].GetArray()) {
+            bins.push_back({level[0u].GetDouble(), level[1u].GetDouble(), level[2u].GetDouble()});
+        }
+        return bins;
+    }
+
+    // Sums of large amounts may differ in the last bits depending on the order they were added in
+    bool close(double a, double b) {
+        return std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(b));
+    }
+
+    void expectBins(const std::string& frame, const char* key, const std::vector<Bin>& expected, const char* what) {
+        std::vector<Bin> bins = side(frame, key);
+        bool same = bins.size() == expected.size();
+        for (size_t i = 0; same && i < bins.size(); ++i) {
+            same = close(bins[i].price, expected[i].price) && close(bins[i].size, expected[i].size) &&
+                   close(bins[i].cumulative, expected[i].cumulative);
+        }
+        check(same, what, frame);
+    }
+
+    void names() {
+        check(viewName("BTC-PERPETUAL", 5, 10) == "depth.BTC-PERPETUAL:5:10", "canonical view name", viewName("BTC-PERPETUAL", 5, 10));
+        check(viewName("BTC-PERPETUAL", 5.0, 10) == viewName("BTC-PERPETUAL", 5, 10), "5 and 5.0 name one view");
+        std::string name;
+        check(!DepthViews::viewName("BTC-PERPETUAL", -1, 10, name), "negative grouping rejected");
+        check(!DepthViews::viewName("BTC-PERPETUAL", 5, 0, name), "zero depth rejected");
+        check(!DepthViews::viewName("BTC-PERPETUAL", 5, DepthViews::kMaxDepth + 1, name), "depth above the limit rejected");
+
+        // Names clients send directly are only accepted in the canonical form
+        std::string instrument;
+        check(DepthViews::viewInstrument("depth.BTC-PERPETUAL:5:10", instrument) && instrument == "BTC-PERPETUAL", "view instrument");
+        for (const char* bad : {"depth.x:y", "depth.BTC-PERPETUAL:5.0:10", "depth.BTC-PERPETUAL:5:0", "depth.BTC-PERPETUAL:-5:10", "depth.:5:10"}) {
+            check(!DepthViews::viewInstrument(bad, instrument), "malformed view name rejected", bad);
+        }
+    }
+
+    void binning() {
+        DepthViews views;
+        std::string wide = viewName("BTC-PERPETUAL", 5, 10);
+        std::string exact = viewName("BTC-PERPETUAL", 0, 10);
+        std::vector<std::string> instruments = views.retain({wide, exact});
+        check(instruments.size() == 1 && instruments[0] == "BTC-PERPETUAL", "one source for views on one instrument");
+        check(views.latest(wide).empty(), "no frame before the first book");
+
+        // Bids round down and asks round up; a price on a bin edge stays in that bin
+        views.applyBook("BTC-PERPETUAL", book(1, "[[100.5,1],[99,2],[95,3],[94.9,4]]", "[[101,1],[104,2],[105,3],[105.1,4]]"));
+        expectBins(views.latest(wide), "bids", {{100, 1, 1}, {95, 5, 6}, {90, 4, 10}}, "bid bins");
+        expectBins(views.latest(wide), "asks", {{105, 6, 6}, {110, 4, 10}}, "ask bins");
+        expectBins(views.latest(exact), "bids", {{100.5, 1, 1}, {99, 2, 3}, {95, 3, 6}, {94.9, 4, 10}}, "grouping 0 keeps exact prices");
+    }
+
+    void diffs() {
+        DepthViews views;
+        std::string top = viewName("ETH-PERPETUAL", 5, 2);
+        views.retain({top});
+        views.applyBook("ETH-PERPETUAL", book(1, "[[100.5,1],[99,2],[95,3],[94.9,4]]", "[[101,1]]"));
+        uint64_t version = 0;
+        std::string frame;
+        check(views.frameSince(top, version, frame), "first frame");
+        expectBins(frame, "bids", {{100, 1, 1}, {95, 5, 6}}, "depth keeps the best bins");
+
+        // Same change id: the book is not applied again
+        check(!views.frameSince(top, version, frame), "no frame without a new book");
+        views.applyBook("ETH-PERPETUAL", book(1, "[[100.5,7]]", "[[101,1]]"));
+        check(!views.frameSince(top, version, frame), "a repeated change id is skipped");
+
+        // Only a bin below the visible depth moves: nothing to send
+        views.applyBook("ETH-PERPETUAL", book(2, "[[100.5,1],[99,2],[95,3],[94.9,6]]", "[[101,1]]"));
+        check(!views.frameSince(top, version, frame), "hidden bins do not resend the frame");
+
+        // 99 leaves, 96 joins and 100.5 grows: applied as a diff against the last book
+        views.applyBook("ETH-PERPETUAL", book(3, "[[100.5,2],[96,1],[95,3],[94.9,6]]", "[[101,1]]"));
+        check(views.frameSince(top, version, frame), "visible change resends the frame");
+        expectBins(frame, "bids", {{100, 2, 2}, {95, 4, 6}}, "bins after a diff");
+
+        // A view created now is built from the whole last book and must agree with the diffed one
+        std::string full = viewName("ETH-PERPETUAL", 5, 10);
+        views.retain({top, full});
+        expectBins(views.latest(full), "bids", {{100, 2, 2}, {95, 4, 6}, {90, 6, 12}}, "diffed bins match a rebuild");
+
+        // An emptied side sends an empty array rather than stale bins
+        views.applyBook("ETH-PERPETUAL", book(4, "[]", "[[101,1]]"));
+        check(views.frameSince(top, version, frame), "emptied side resends the frame");
+        expectBins(frame, "bids", {}, "emptied side has no bins");
+    }
+
+    void largeAmounts() {
+        // USD-sized amounts that binary floating point cannot hold exactly: adding them up
+        // and taking them out again leaves a residue far above any fixed epsilon
+        DepthViews views;
+        std::string top = viewName("SOL-PERPETUAL", 10, 1);
+        std::string diffed = viewName("SOL-PERPETUAL", 10, 10);
+        views.retain({top, diffed});
+        views.applyBook("SOL-PERPETUAL", book(1, "[[102,20000000.7],[101,0.3],[100,10000000.1],[90,5]]", "[[110,1]]"));
+        expectBins(views.latest(top), "bids", {{100, 30000001.1, 30000001.1}}, "large amounts binned");
+
+        // The 100 bin loses all its levels: it must go, not linger as a ghost in the visible depth
+        views.applyBook("SOL-PERPETUAL", book(2, "[[90,5]]", "[[110,1]]"));
+        expectBins(views.latest(top), "bids", {{90, 5, 5}}, "emptied bin disappears");
+
+        views.applyBook("SOL-PERPETUAL", book(3, "[[101,0.7],[100,10000000.3],[92,12345678.9],[90,5]]", "[[110,1]]"));
+        views.applyBook("SOL-PERPETUAL", book(4, "[[101,0.1],[92,12345678.9],[91,0.2]]", "[[110,1]]"));
+        std::string rebuilt = viewName("SOL-PERPETUAL", 10, 9);
+        views.retain({top, diffed, rebuilt});
+        std::vector<Bin> expected = {{100, 0.1, 0.1}, {90, 12345679.1, 12345679.2}};
+        expectBins(views.latest(diffed), "bids", expected, "large amounts after diffs");
+        expectBins(views.latest(rebuilt), "bids", expected, "large amounts rebuilt from the last book");
+    }
+}
+
+int main() {
+    names();
+    binning();
+    diffs();
+    largeAmounts();
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("depth views: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "options_analytics.hpp"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// Books of every instrument a client watches reach the analytics engine. Only an
+// option the loaded chain does not list may trigger a reload; perpetuals and
+// futures of the same currency must leave the chain (and its solved columns) alone.
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what) {
+        if (!ok) {
+            std::printf("FAIL %s\n", what);
+            ++failures;
+        }
+    }
+
+    std::string book(const std::string& instrument, double bid, double ask) {
+        return R"({"result":{"instrument_name":")" + instrument + R"(","best_bid_price":)" + std::to_string(bid) +
+               R"(,"best_ask_price":)" + std::to_string(ask) + R"(,"underlying_price":50000}})";
+    }
+}
+
+int main() {
+    int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string expiry = std::to_string(nowMs + 30LL * 24 * 3600 * 1000);
+    std::string instruments =
+        R"({"result":[)"
+        R"({"kind":"option","instrument_name":"BTC-1JAN40-60000-C","strike":60000,"option_type":"call","expiration_timestamp":)" + expiry + "}," +
+        R"({"kind":"option","instrument_name":"BTC-1JAN40-40000-P","strike":40000,"option_type":"put","expiration_timestamp":)" + expiry + "}," +
+        R"({"kind":"future","instrument_name":"BTC-PERPETUAL"}]})";
+
+    OptionsAnalytics analytics;
+    check(analytics.loadChain("BTC", instruments) == 2, "chain lists the two options");
+    check(!analytics.reloadDue("BTC"), "a fresh chain is not reloaded");
+
+    check(!analytics.applyOrderBook(book("BTC-PERPETUAL", 50000, 50001)), "a perpetual book is not an option quote");
+    check(!analytics.applyOrderBook(book("BTC-27DEC30", 50100, 50102)), "a dated future book is not an option quote");
+    check(!analytics.reloadDue("BTC"), "perpetual and future books do not reload the chain");
+
+    check(analytics.applyOrderBook(book("BTC-1JAN40-60000-C", 0.01, 0.012)), "a listed option updates its quote");
+    check(!analytics.reloadDue("BTC"), "a listed option does not reload the chain");
+
+    check(!analytics.applyOrderBook(book("BTC-1JAN40-70000-C", 0.005, 0.006)), "an unlisted option is not applied");
+    check(analytics.reloadDue("BTC"), "an unlisted option reloads the chain");
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("options analytics: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "options_pricing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Batch solves over a full strike ladder must match solving each strike on its own:
+// lanes that converge early may not be disturbed by the rest of their block.
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what, double a, double b) {
+        if (!ok) {
+            std::printf("FAIL %s: %.12g vs %.12g\n", what, a, b);
+            ++failures;
+        }
+    }
+
+    bool same(double a, double b, double tolerance) {
+        return (std::isnan(a) && std::isnan(b)) || std::fabs(a - b) <= tolerance;
+    }
+
+    void ladder(double forward, double t, double trueVol, double sign) {
+        const size_t n = 1000;
+        std::vector<double> strike(n), signs(n, sign), price(n), vol(n);
+        for (size_t i = 0; i < n; ++i) {
+            strike[i] = 30000.0 + 60.0 * i;
+            price[i] = OptionsPricing::black76Price(forward, strike[i], trueVol, t, sign);
+        }
+        OptionsPricing::impliedVolBatch(forward, t, strike.data(), signs.data(), price.data(), vol.data(), n);
+
+        for (size_t i = 0; i < n; ++i) {
+            double single = 0.0;
+            OptionsPricing::impliedVolBatch(forward, t, &strike[i], &sign, &price[i], &single, 1);
+
+            // Both stop anywhere within the price tolerance, i.e. within tolerance / vega of the root
+            double sd = trueVol * std::sqrt(t);
+            double d1 = (std::log(forward / strike[i]) + 0.5 * sd * sd) / sd;
+            double vega = forward * std::exp(-0.5 * d1 * d1) / std::sqrt(2.0 * 3.14159265358979323846) * std::sqrt(t);
+            double slack = 2e-10 * forward / vega;
+            check(same(vol[i], single, std::max(1e-9, slack)), "batch matches scalar", vol[i], single);
+            // Where the price still moves with vol, the solve must recover the vol it was priced at
+            if (vega > 1.0) {
+                check(std::fabs(vol[i] - trueVol) < std::max(1e-9, slack), "recovers the pricing vol", vol[i], trueVol);
+            }
+        }
+    }
+}
+
+int main() {
+    for (double trueVol : {0.2, 0.8, 1.5}) {
+        ladder(60000.0, 0.1, trueVol, 1.0);
+        ladder(60000.0, 0.1, trueVol, -1.0);
+    }
+
+    // Prices outside no-arbitrage bounds, or missing, have no implied vol
+    const double forward = 60000.0;
+    double strike[] = {50000.0, 50000.0, 70000.0, 70000.0};
+    double sign[] = {1.0, 1.0, -1.0, 1.0};
+    double price[] = {9000.0, 60000.0, 10000.0, std::nan("")};
+    double vol[4];
+    OptionsPricing::impliedVolBatch(forward, 0.1, strike, sign, price, vol, 4);
+    for (double v : vol) {
+        check(std::isnan(v), "invalid price gives NaN", v, 0.0);
+    }
+
+    // Delta against a central difference of the price
+    double k = 65000.0;
+    double s = 1.0;
+    double v = 0.6;
+    double delta, gamma, vega, theta;
+    OptionsPricing::greeksBatch(forward, 0.25, &k, &s, &v, &delta, &gamma, &vega, &theta, 1);
+    double h = 1.0;
+    double numeric = (OptionsPricing::black76Price(forward + h, k, v, 0.25, s) - OptionsPricing::black76Price(forward - h, k, v, 0.25, s)) / (2 * h);
+    check(std::fabs(delta - numeric) < 1e-6, "delta", delta, numeric);
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("options pricing: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "loopback_exchange.hpp"
+#include "order_manager.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+// Orders sharded over several accounts, against a loopback exchange that keeps each
+// account's orders, positions and credit bucket apart: orders stay on the account
+// they were routed to, edits and cancels follow them there, and one account running
+// out of credits does not slow the others.
+
+namespace {
+    int failures = 0;
+    const std::vector<std::string> kAccounts = {"a", "b", "c"};
+
+    void check(bool ok, const char* what, const std::string& detail = "") {
+        if (!ok) {
+            std::printf("FAIL %s %s\n", what, detail.c_str());
+            ++failures;
+        }
+    }
+
+    std::string orderId(const std::string& response) {
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("result") || !doc["result"].IsObject() ||
+            !doc["result"].HasMember("order")) {
+            return "";
+        }
+        return doc["result"]["order"]["order_id"].GetString();
+    }
+
+    bool isError(const std::string& response) {
+        return response.find("\"error\"") != std::string::npos;
+    }
+
+    uint64_t totalCalls(LoopbackExchange& exchange, const std::string& method) {
+        uint64_t total = 0;
+        for (const auto& account : kAccounts) {
+            total += exchange.calls(account, method);
+        }
+        return total;
+    }
+
+    void routing(OrderManager& orderManager, LoopbackExchange& exchange) {
+        // By instrument: every order on an instrument lands on the same account
+        std::set<std::string> used;
+        for (const char* instrument : {"BTC-PERPETUAL", "ETH-PERPETUAL", "SOL_USDC-PERPETUAL", "BTC-27DEC24", "ETH-27DEC24", "XRP_USDC-PERPETUAL"}) {
+            std::string first = orderId(orderManager.placeOrder(instrument, "buy", 10.0, 100.0, "limit"));
+            std::string second = orderId(orderManager.placeOrder(instrument, "sell", 10.0, 200.0, "limit"));
+            check(!first.empty() && !second.empty(), "order placed", instrument);
+            check(exchange.ownerOf(first) == exchange.ownerOf(second), "one instrument trades on one account", instrument);
+            used.insert(exchange.ownerOf(first));
+        }
+        check(used.size() > 1, "instruments are spread over the accounts");
+
+        // A pinned strategy tag goes to its account
+        orderManager.setRoutingPolicy(OrderManager::RoutingPolicy::ByStrategyTag);
+        orderManager.assignStrategy("pinned", 2);
+        std::string pinned = orderId(orderManager.placeOrder("BTC-PERPETUAL", "buy", 10.0, 100.0, "limit", "pinned"));
+        check(exchange.ownerOf(pinned) == "c", "strategy tag routes to its account", exchange.ownerOf(pinned));
+
+        // Edits and cancels go only to the owning account
+        uint64_t edits = totalCalls(exchange, "private/edit");
+        uint64_t cancels = totalCalls(exchange, "private/cancel");
+        check(!isError(orderManager.modifyOrder(pinned, 20.0, 101.0)), "edit of a tracked order");
+        check(!isError(orderManager.cancelOrder(pinned)), "cancel of a tracked order");
+        check(totalCalls(exchange, "private/edit") == edits + 1, "edit sent once, to the owner");
+        check(totalCalls(exchange, "private/cancel") == cancels + 1, "cancel sent once, to the owner");
+        check(exchange.ownerOf(pinned).empty(), "tracked order cancelled");
+    }
+
+    void untrackedOrders(OrderManager& orderManager, LoopbackExchange& exchange) {
+        // Placed on account b behind the manager's back: the cancel is tried on every account
+        std::string foreign = exchange.addOrder("b", "ETH-PERPETUAL", 1.0, 2000.0);
+        std::map<std::string, uint64_t> before;
+        for (const auto& account : kAccounts) {
+            before[account] = exchange.calls(account, "private/cancel");
+        }
+        std::string response = orderManager.cancelOrder(foreign);
+        check(!isError(response), "untracked order cancelled", response);
+        check(exchange.ownerOf(foreign).empty(), "untracked order gone from its account");
+        for (const auto& account : kAccounts) {
+            check(exchange.calls(account, "private/cancel") == before[account] + 1, "untracked cancel fans out", account);
+        }
+
+        // No account has it: the exchange's error comes back instead of a silent success
+        response = orderManager.cancelOrder("LB-unknown");
+        check(response.find("order_not_found") != std::string::npos, "unknown order reports order_not_found", response);
+    }
+
+    void positions(OrderManager& orderManager, LoopbackExchange& exchange) {
+        // Offsetting positions: the net +5 breaks even at 90, not at a blend of |size|
+        exchange.setPosition("a", "BTC-PERPETUAL", 10.0, 100.0);
+        exchange.setPosition("b", "BTC-PERPETUAL", -5.0, 110.0);
+        std::string response = orderManager.getCurrentPositions("BTC");
+        rapidjson::Document doc;
+        doc.Parse(response.c_str());
+        if (doc.HasParseError() || !doc.HasMember("result") || !doc["result"].IsArray() || doc["result"].Size() != 1) {
+            check(false, "merged positions", response);
+            return;
+        }
+        const auto& net = doc["result"][0u];
+        check(net["size"].GetDouble() == 5.0, "net size", response);
+        check(std::fabs(net["average_price"].GetDouble() - 90.0) < 1e-9, "net average price", response);
+        check(net["per_account"].IsArray() && net["per_account"].Size() == 2, "per-account legs", response);
+        for (const auto& leg : net["per_account"].GetArray()) {
+            double expected = leg["account"].GetUint64() == 0 ? 100.0 : 110.0;
+            check(leg["average_price"].GetDouble() == expected, "per-account average price", response);
+        }
+    }
+
+    void publicCalls(OrderManager& orderManager) {
+        // Market data goes to the configured exchange, like the sessions
+        check(orderManager.getOrderBook("BTC-PERPETUAL").find("change_id") != std::string::npos, "order book from the configured exchange");
+        check(orderManager.getInstrumentOrderbook("BTC-PERPETUAL").find("change_id") != std::string::npos,
+              "instrument order book from the configured exchange");
+        check(orderManager.getInstruments().find("\"result\"") != std::string::npos, "instruments from the configured exchange");
+    }
+
+    void creditLimits(OrderManager& orderManager, LoopbackExchange& exchange) {
+        // Each account gets 5 credits refilled at 20/s. Account a's local model is looser than
+        // the exchange, so its burst is throttled there; b stays within its own bucket.
+        exchange.setCreditLimit(5.0, 20.0);
+        orderManager.session(0).setRateLimits({10.0, 20.0, 1.0}, {1e12, 1e12, 1.0});
+        orderManager.assignStrategy("burst", 0);
+        orderManager.assignStrategy("quiet", 1);
+        size_t openA = exchange.openOrders("a");
+        size_t openB = exchange.openOrders("b");
+
+        const int burst = 15;
+        const int quiet = 3;
+        std::vector<std::future<bool>> acks;
+        for (int i = 0; i < burst + quiet; ++i) {
+            auto promise = std::make_shared<std::promise<bool>>();
+            acks.push_back(promise->get_future());
+            orderManager.placeOrderAsync("BTC-PERPETUAL", "buy", 10.0, 100.0 + i, "limit", [promise](bool ok, const std::string& response) {
+                promise->set_value(ok && !isError(response));
+            }, i < burst ? "burst" : "quiet");
+        }
+        for (auto& ack : acks) {
+            bool answered = ack.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+            check(answered && ack.get(), "throttled orders are retried until accepted");
+        }
+        check(exchange.rateLimited("a") > 0, "the busy account hits its credit limit");
+        check(exchange.rateLimited("b") == 0, "other accounts keep their own credits");
+        check(exchange.openOrders("a") == openA + burst, "burst lands on its account");
+        check(exchange.openOrders("b") == openB + quiet, "quiet orders land on theirs");
+    }
+}
+
+int main() {
+    LoopbackExchange exchange;
+    {
+        std::vector<OrderManager::Account> accounts;
+        for (const auto& account : kAccounts) {
+            accounts.push_back({account, "secret"});
+        }
+        OrderManager orderManager(accounts, exchange.url(), nullptr, ExchangeSession::Transport::Http);
+        for (size_t i = 0; i < orderManager.sessionCount(); ++i) {
+            orderManager.session(i).setRateLimits({1e12, 1e12, 1.0}, {1e12, 1e12, 1.0});
+        }
+
+        routing(orderManager, exchange);
+        untrackedOrders(orderManager, exchange);
+        positions(orderManager, exchange);
+        publicCalls(orderManager);
+        creditLimits(orderManager, exchange);
+    }
+
+    if (failures > 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("order routing: all checks passed\n");
+    return 0;
+}